@@ -1,9 +1,8 @@
 #pragma once
 
 #include <cmath>
-#include <climits>
 #include <algorithm>
-#include <climits>
+#include <limits>
 
 namespace isect2d {
 
@@ -13,9 +12,13 @@ enum Dimension {
 
 template<typename V>
 struct AABB {
-    AABB() : AABB(INT_MAX, INT_MAX, -INT_MAX, -INT_MAX) {}
+    using Value = decltype(V::x);
 
-    AABB(float _minx, float _miny, float _maxx, float _maxy)
+    // Empty box, any include() sets both corners
+    AABB() : AABB(std::numeric_limits<Value>::max(), std::numeric_limits<Value>::max(),
+                  std::numeric_limits<Value>::lowest(), std::numeric_limits<Value>::lowest()) {}
+
+    AABB(Value _minx, Value _miny, Value _maxx, Value _maxy)
         : min(_minx, _miny), max(_maxx, _maxy) {
     }
 
@@ -46,7 +49,7 @@ struct AABB {
         return Y;
     }
 
-    void include(float _x, float _y) {
+    void include(Value _x, Value _y) {
         min.x = std::min(min.x, _x);
         min.y = std::min(min.y, _y);
         max.x = std::max(max.x, _x);
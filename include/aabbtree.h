@@ -0,0 +1,414 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "aabb.h"
+
+namespace isect2d {
+
+/*
+ * Dynamic bounding volume hierarchy, kept balanced with tree rotations.
+ *
+ * Leaves store the bounds of a box fattened by margin, so that a box moving
+ * within its fat bounds only needs its tight bounds refreshed by update().
+ * Re-insertions, and thus the per-frame cost of updates, are then
+ * proportional to the number of boxes that moved significantly.
+ */
+template<typename V>
+struct AABBTree {
+    using Value = typename V::value_type;
+
+    static const int32_t null = -1;
+
+    // Distance by which the stored bounds are fattened on each side
+    Value margin = 4;
+
+    // Colliding pairs of the last intersect(), as ids returned by insert()
+    // with first < second
+    std::vector<std::pair<int32_t, int32_t>> pairs;
+
+    // Returns the id of the new box
+    int32_t insert(const AABB<V>& _aabb) {
+        int32_t id = allocateNode();
+
+        nodes[id].tight = _aabb;
+        nodes[id].aabb = fatten(_aabb);
+        nodes[id].height = 0;
+
+        insertLeaf(id);
+        count++;
+
+        return id;
+    }
+
+    void remove(int32_t _id) {
+        removeLeaf(_id);
+        freeNode(_id);
+        count--;
+    }
+
+    // Moves the box _id to _aabb, returns true when the box left its fat
+    // bounds and had to be re-inserted
+    bool update(int32_t _id, const AABB<V>& _aabb) {
+        Node& node = nodes[_id];
+        node.tight = _aabb;
+
+        if (contains(node.aabb, _aabb)) {
+            return false;
+        }
+
+        removeLeaf(_id);
+        nodes[_id].aabb = fatten(_aabb);
+        insertLeaf(_id);
+
+        return true;
+    }
+
+    void clear() {
+        nodes.clear();
+        pairs.clear();
+        root = null;
+        freeList = null;
+        count = 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    const AABB<V>& getAABB(int32_t _id) const {
+        return nodes[_id].tight;
+    }
+
+    const AABB<V>& getFatAABB(int32_t _id) const {
+        return nodes[_id].aabb;
+    }
+
+    int32_t getHeight() const {
+        return root == null ? 0 : nodes[root].height;
+    }
+
+    /*
+     * Calls _visit(id) for each box whose bounds intersect _aabb, stops as
+     * soon as _visit returns false
+     */
+    template<typename Visit>
+    void query(const AABB<V>& _aabb, Visit&& _visit) const {
+        if (root == null) { return; }
+
+        stack.clear();
+        stack.push_back(root);
+
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            int32_t id = stack.back();
+            stack.pop_back();
+
+            if (!node.aabb.intersect(_aabb)) {
+                continue;
+            }
+
+            if (node.isLeaf()) {
+                if (node.tight.intersect(_aabb) && !_visit(id)) {
+                    return;
+                }
+            } else {
+                stack.push_back(node.child1);
+                stack.push_back(node.child2);
+            }
+        }
+    }
+
+    /*
+     * Collects all pairs of intersecting boxes in pairs, descending both
+     * sides of the tree at once from the root
+     */
+    void intersect() {
+        pairs.clear();
+
+        if (root == null) { return; }
+
+        pairStack.clear();
+        pairStack.emplace_back(root, root);
+
+        while (!pairStack.empty()) {
+            int32_t a = pairStack.back().first;
+            int32_t b = pairStack.back().second;
+            pairStack.pop_back();
+
+            const Node& na = nodes[a];
+            const Node& nb = nodes[b];
+
+            if (a == b) {
+                if (!na.isLeaf()) {
+                    pairStack.emplace_back(na.child1, na.child1);
+                    pairStack.emplace_back(na.child2, na.child2);
+                    pairStack.emplace_back(na.child1, na.child2);
+                }
+                continue;
+            }
+
+            if (!na.aabb.intersect(nb.aabb)) {
+                continue;
+            }
+
+            if (na.isLeaf() && nb.isLeaf()) {
+                if (na.tight.intersect(nb.tight)) {
+                    pairs.emplace_back(std::min(a, b), std::max(a, b));
+                }
+            } else if (nb.isLeaf() || (!na.isLeaf() && na.height >= nb.height)) {
+                pairStack.emplace_back(na.child1, b);
+                pairStack.emplace_back(na.child2, b);
+            } else {
+                pairStack.emplace_back(a, nb.child1);
+                pairStack.emplace_back(a, nb.child2);
+            }
+        }
+    }
+
+private:
+    struct Node {
+        // Fat bounds for leaves, union of the children otherwise
+        AABB<V> aabb;
+        AABB<V> tight;
+
+        // Next free node when the node is unused
+        int32_t parent = null;
+        int32_t child1 = null;
+        int32_t child2 = null;
+
+        // 0 for leaves, -1 for unused nodes
+        int32_t height = -1;
+
+        bool isLeaf() const {
+            return child1 == null;
+        }
+    };
+
+    std::vector<Node> nodes;
+    int32_t root = null;
+    int32_t freeList = null;
+    size_t count = 0;
+
+    mutable std::vector<int32_t> stack;
+    std::vector<std::pair<int32_t, int32_t>> pairStack;
+
+    AABB<V> fatten(const AABB<V>& _aabb) const {
+        return AABB<V>(_aabb.min.x - margin, _aabb.min.y - margin,
+                       _aabb.max.x + margin, _aabb.max.y + margin);
+    }
+
+    static bool contains(const AABB<V>& _outer, const AABB<V>& _inner) {
+        return _outer.min.x <= _inner.min.x && _outer.min.y <= _inner.min.y &&
+               _outer.max.x >= _inner.max.x && _outer.max.y >= _inner.max.y;
+    }
+
+    static Value perimeter(const AABB<V>& _aabb) {
+        return 2 * ((_aabb.max.x - _aabb.min.x) + (_aabb.max.y - _aabb.min.y));
+    }
+
+    int32_t allocateNode() {
+        if (freeList == null) {
+            nodes.emplace_back();
+            return nodes.size() - 1;
+        }
+
+        int32_t id = freeList;
+        freeList = nodes[id].parent;
+        nodes[id] = Node();
+
+        return id;
+    }
+
+    void freeNode(int32_t _id) {
+        nodes[_id].parent = freeList;
+        nodes[_id].height = -1;
+        freeList = _id;
+    }
+
+    void insertLeaf(int32_t _leaf) {
+        if (root == null) {
+            root = _leaf;
+            nodes[root].parent = null;
+            return;
+        }
+
+        // Find the sibling minimizing the perimeter of the tree
+        AABB<V> leafAABB = nodes[_leaf].aabb;
+        int32_t index = root;
+
+        while (!nodes[index].isLeaf()) {
+            const Node& node = nodes[index];
+
+            Value area = perimeter(node.aabb);
+            Value combined = perimeter(unionAABB(node.aabb, leafAABB));
+
+            // Cost of a new parent for this node and the leaf
+            Value cost = 2 * combined;
+            // Minimum cost of pushing the leaf further down the tree
+            Value inheritance = 2 * (combined - area);
+
+            auto descendCost = [&](int32_t _child) {
+                const Node& child = nodes[_child];
+                Value c = perimeter(unionAABB(leafAABB, child.aabb));
+                if (!child.isLeaf()) {
+                    c -= perimeter(child.aabb);
+                }
+                return c + inheritance;
+            };
+
+            Value cost1 = descendCost(node.child1);
+            Value cost2 = descendCost(node.child2);
+
+            if (cost < cost1 && cost < cost2) {
+                break;
+            }
+
+            index = cost1 < cost2 ? node.child1 : node.child2;
+        }
+
+        int32_t sibling = index;
+        int32_t oldParent = nodes[sibling].parent;
+        int32_t newParent = allocateNode();
+
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].aabb = unionAABB(leafAABB, nodes[sibling].aabb);
+        nodes[newParent].height = nodes[sibling].height + 1;
+        nodes[newParent].child1 = sibling;
+        nodes[newParent].child2 = _leaf;
+        nodes[sibling].parent = newParent;
+        nodes[_leaf].parent = newParent;
+
+        if (oldParent == null) {
+            root = newParent;
+        } else if (nodes[oldParent].child1 == sibling) {
+            nodes[oldParent].child1 = newParent;
+        } else {
+            nodes[oldParent].child2 = newParent;
+        }
+
+        refit(nodes[_leaf].parent);
+    }
+
+    void removeLeaf(int32_t _leaf) {
+        if (_leaf == root) {
+            root = null;
+            return;
+        }
+
+        int32_t parent = nodes[_leaf].parent;
+        int32_t grandParent = nodes[parent].parent;
+        int32_t sibling = nodes[parent].child1 == _leaf
+            ? nodes[parent].child2 : nodes[parent].child1;
+
+        freeNode(parent);
+
+        if (grandParent == null) {
+            root = sibling;
+            nodes[sibling].parent = null;
+            return;
+        }
+
+        if (nodes[grandParent].child1 == parent) {
+            nodes[grandParent].child1 = sibling;
+        } else {
+            nodes[grandParent].child2 = sibling;
+        }
+        nodes[sibling].parent = grandParent;
+
+        refit(grandParent);
+    }
+
+    // Rebalances and updates the bounds and heights from _index up to the root
+    void refit(int32_t _index) {
+        while (_index != null) {
+            _index = balance(_index);
+
+            Node& node = nodes[_index];
+            const Node& child1 = nodes[node.child1];
+            const Node& child2 = nodes[node.child2];
+
+            node.height = 1 + std::max(child1.height, child2.height);
+            node.aabb = unionAABB(child1.aabb, child2.aabb);
+
+            _index = node.parent;
+        }
+    }
+
+    /*
+     * Rotates A's higher child up when the heights of its children differ
+     * by more than one, returns the new root of the subtree
+     *
+     *         A                C
+     *        / \              / \
+     *       B   C     ->     A   F
+     *          / \          / \
+     *         F   G        B   G
+     */
+    int32_t balance(int32_t _a) {
+        Node& a = nodes[_a];
+
+        if (a.isLeaf() || a.height < 2) {
+            return _a;
+        }
+
+        int32_t b = a.child1;
+        int32_t c = a.child2;
+        int32_t diff = nodes[c].height - nodes[b].height;
+
+        if (diff > 1) {
+            return rotate(_a, c, b);
+        }
+        if (diff < -1) {
+            return rotate(_a, b, c);
+        }
+        return _a;
+    }
+
+    // Moves _up in place of _a, _a keeping _other and the lowest child of _up
+    int32_t rotate(int32_t _a, int32_t _up, int32_t _other) {
+        Node& a = nodes[_a];
+        Node& up = nodes[_up];
+
+        int32_t f = up.child1;
+        int32_t g = up.child2;
+
+        up.child1 = _a;
+        up.parent = a.parent;
+        a.parent = _up;
+
+        if (up.parent == null) {
+            root = _up;
+        } else if (nodes[up.parent].child1 == _a) {
+            nodes[up.parent].child1 = _up;
+        } else {
+            nodes[up.parent].child2 = _up;
+        }
+
+        // Keep the higher grandchild under _up
+        if (nodes[f].height < nodes[g].height) {
+            std::swap(f, g);
+        }
+
+        up.child2 = f;
+        if (a.child1 == _up) {
+            a.child1 = g;
+        } else {
+            a.child2 = g;
+        }
+        nodes[g].parent = _a;
+
+        a.aabb = unionAABB(nodes[_other].aabb, nodes[g].aabb);
+        up.aabb = unionAABB(a.aabb, nodes[f].aabb);
+
+        a.height = 1 + std::max(nodes[_other].height, nodes[g].height);
+        up.height = 1 + std::max(a.height, nodes[f].height);
+
+        return _up;
+    }
+};
+
+}
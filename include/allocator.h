@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+namespace isect2d {
+
+/*
+ * Allocations made through CheckedAllocator on the current thread. While
+ * a NoAllocationScope is alive on the thread, any such allocation fails
+ * an assert, so that a frame expected to reuse its buffers can be checked
+ * in debug builds. The counts are kept in release builds too.
+ */
+struct AllocationCounter {
+    size_t allocations = 0;
+    size_t bytes = 0;
+
+    // NoAllocationScopes alive on the thread
+    int scopes = 0;
+
+    static AllocationCounter& get() {
+        static thread_local AllocationCounter counter;
+        return counter;
+    }
+};
+
+struct NoAllocationScope {
+    NoAllocationScope() { AllocationCounter::get().scopes++; }
+    ~NoAllocationScope() { AllocationCounter::get().scopes--; }
+
+    NoAllocationScope(const NoAllocationScope&) = delete;
+    NoAllocationScope& operator=(const NoAllocationScope&) = delete;
+};
+
+/*
+ * std::allocator counting its allocations in AllocationCounter, to use as
+ * the allocator of an ISect2D:
+ *
+ *   ISect2D<Vec2, CheckedAllocator> context;
+ */
+template<typename T>
+struct CheckedAllocator {
+    using value_type = T;
+
+    CheckedAllocator() {}
+
+    template<typename U>
+    CheckedAllocator(const CheckedAllocator<U>&) {}
+
+    T* allocate(size_t _n) {
+        AllocationCounter& counter = AllocationCounter::get();
+        assert(counter.scopes == 0 && "allocation inside of a NoAllocationScope");
+
+        counter.allocations++;
+        counter.bytes += _n * sizeof(T);
+
+        return std::allocator<T>().allocate(_n);
+    }
+
+    void deallocate(T* _p, size_t _n) {
+        std::allocator<T>().deallocate(_p, _n);
+    }
+};
+
+template<typename T, typename U>
+inline bool operator==(const CheckedAllocator<T>&, const CheckedAllocator<U>&) {
+    return true;
+}
+
+template<typename T, typename U>
+inline bool operator!=(const CheckedAllocator<T>&, const CheckedAllocator<U>&) {
+    return false;
+}
+
+}
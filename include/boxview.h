@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace isect2d {
+
+/*
+ * Read-only view of boxes living in user memory, to run the broadphase
+ * without copying them into a vector of AABBs. The view holds _count
+ * records of type T placed _stride bytes apart, and _get(record) returns
+ * the bounds of a record as anything with min and max members, such as
+ * an AABB or a reference to one.
+ */
+template<typename T, typename Get>
+struct BoxView {
+
+    BoxView(const T* _data, size_t _count, size_t _stride, Get _get)
+        : data(reinterpret_cast<const uint8_t*>(_data)),
+          count(_count), stride(_stride), get(std::move(_get)) {}
+
+    size_t size() const {
+        return count;
+    }
+
+    auto operator[](size_t _i) const -> decltype(std::declval<const Get&>()(std::declval<const T&>())) {
+        return get(*reinterpret_cast<const T*>(data + _i * stride));
+    }
+
+private:
+
+    const uint8_t* data;
+    size_t count;
+    size_t stride;
+    Get get;
+
+};
+
+template<typename T, typename Get>
+inline BoxView<T, Get> boxView(const T* _data, size_t _count, Get _get, size_t _stride = sizeof(T)) {
+    return BoxView<T, Get>(_data, _count, _stride, std::move(_get));
+}
+
+template<typename T, typename Get>
+inline BoxView<T, Get> boxView(const std::vector<T>& _records, Get _get) {
+    return BoxView<T, Get>(_records.data(), _records.size(), sizeof(T), std::move(_get));
+}
+
+}
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+#include "isect2d.h"
+
+namespace isect2d {
+
+/*
+ * Spatial hash grid broadphase, for coordinates without fixed bounds such
+ * as world or tile space. Cells of cellSize are keyed by their integer
+ * coordinates in an open addressing table, so memory only grows with the
+ * number of cells holding boxes, wherever they lie. Boxes much larger than
+ * the cells are added to each cell they cover, as in ISect2D.
+ *
+ * pairs and the single-box intersect() follow ISect2D: each intersecting
+ * pair is reported once with first < second, by the cell holding the min
+ * corner of the overlap of both boxes.
+ */
+template<typename V>
+struct HashGrid {
+    using Value = typename V::value_type;
+    using i32 = int_fast32_t;
+    using Pair = typename ISect2D<V>::Pair;
+
+    using CellSpan = isect2d::CellSpan;
+
+    Value cell_x = 1;
+    Value cell_y = 1;
+
+    std::vector<Pair> pairs;
+
+    // Boxes added by the single-box intersect() and insert()
+    std::vector<AABB<V>> aabbs;
+
+    HashGrid(const V _cellSize = V(64, 64)) {
+        resize(_cellSize);
+    }
+
+    void resize(const V _cellSize) {
+        cell_x = _cellSize.x > 0 ? Value(_cellSize.x) : Value(1);
+        cell_y = _cellSize.y > 0 ? Value(_cellSize.y) : Value(1);
+        clear();
+    }
+
+    void clear() {
+        pairs.clear();
+        aabbs.clear();
+        clearCells();
+    }
+
+    // Number of cells holding boxes
+    size_t getCellCount() const {
+        return occupied.size();
+    }
+
+    template<typename Box>
+    CellSpan cellSpan(const Box& _box) const {
+        return { cellOf(Value(_box.min.x), cell_x), cellOf(Value(_box.min.y), cell_y),
+                 cellOf(Value(_box.max.x), cell_x) + 1, cellOf(Value(_box.max.y), cell_y) + 1 };
+    }
+
+    /*
+     * Reports in pairs the intersecting pairs of _aabbs, as indices in
+     * _aabbs. Boxes inserted before are cleared.
+     */
+    void intersect(const std::vector<AABB<V>>& _aabbs) {
+        collideAll(_aabbs);
+    }
+
+    // Same as above, for boxes read in place through a BoxView
+    template<typename T, typename Get>
+    void intersect(const BoxView<T, Get>& _boxes) {
+        collideAll(_boxes);
+    }
+
+    /*
+     * Calls _visit(_aabb, other) once for each box inserted before that
+     * intersects _aabb, stops as soon as _visit returns false. _aabb is
+     * then inserted when _insert is set, unless the visit was stopped.
+     */
+    template<typename Visit>
+    void intersect(const AABB<V>& _aabb, Visit&& _visit, bool _insert = true) {
+        CellSpan s = cellSpan(_aabb);
+
+        if (query(_aabb, s, _visit) && _insert) {
+            place(_aabb, s);
+        }
+    }
+
+    void intersect(const AABB<V>& _aabb,
+                   std::function<bool(const AABB<V>& _aabb, const AABB<V>& _other)> _cb,
+                   bool _insert = true) {
+
+        CellSpan s = cellSpan(_aabb);
+
+        if (query(_aabb, s, _cb) && _insert) {
+            place(_aabb, s);
+        }
+    }
+
+    void insert(const AABB<V>& _aabb) {
+        place(_aabb, cellSpan(_aabb));
+    }
+
+private:
+
+    // Cell of the table, empty while count is 0
+    struct Slot {
+        int32_t x, y;
+        // First node of the boxes of the cell
+        int32_t head;
+        int32_t count;
+        // Rank of the slot in occupied, which is kept when the table grows
+        int32_t rank;
+    };
+
+    // Entry of a box in a cell, chained to the previous entry of the cell
+    struct Node {
+        int32_t box;
+        int32_t next;
+    };
+
+    // Power of two sized open addressing table, probed linearly
+    std::vector<Slot> slots;
+    // Slots in use, in the order they were first used
+    std::vector<int32_t> occupied;
+    std::vector<Node> nodes;
+    std::vector<CellSpan> spans;
+
+    // Counting sort of the boxes of collideAll() into the cells, ranked
+    // as in occupied. Cell c owns [cellOffsets[c], cellOffsets[c+1]) of
+    // cellIndices, and entryCells is the cell of each entry in binning order.
+    std::vector<int32_t> entryCells;
+    std::vector<int32_t> cellOffsets;
+    std::vector<int32_t> cellIndices;
+
+    template<typename T = Value>
+    static typename std::enable_if<std::is_integral<T>::value, i32>::type
+    cellOf(T _v, T _size) {
+        // Rounded towards minus infinity
+        int64_t v = _v;
+        return i32(v >= 0 ? v / _size : -((-v - 1) / _size) - 1);
+    }
+
+    template<typename T = Value>
+    static typename std::enable_if<!std::is_integral<T>::value, i32>::type
+    cellOf(T _v, T _size) {
+        // Bounded so that cells fit in int32_t, NaN ends up in the last one
+        T c = std::min(T(1 << 30), _v / _size);
+        return i32(std::floor(std::max(T(-(1 << 30)), c)));
+    }
+
+    // fmix64 from MurmurHash3
+    static size_t hash(i32 _x, i32 _y) {
+        uint64_t k = uint64_t(uint32_t(_x)) << 32 | uint32_t(_y);
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return size_t(k);
+    }
+
+    // Slot of cell (_x, _y), or -1 when it holds no box
+    int32_t findSlot(i32 _x, i32 _y) const {
+        if (occupied.empty()) { return -1; }
+
+        size_t mask = slots.size() - 1;
+        size_t i = hash(_x, _y) & mask;
+
+        while (slots[i].count != 0) {
+            if (slots[i].x == _x && slots[i].y == _y) {
+                return i;
+            }
+            i = (i + 1) & mask;
+        }
+        return -1;
+    }
+
+    // Counts one more box in cell (_x, _y) and returns its slot, taking a
+    // new one if needed. The table is kept at most half full.
+    int32_t useSlot(i32 _x, i32 _y) {
+        if (2 * (occupied.size() + 1) > slots.size()) {
+            grow();
+        }
+
+        size_t mask = slots.size() - 1;
+        size_t i = hash(_x, _y) & mask;
+
+        while (slots[i].count != 0 && (slots[i].x != _x || slots[i].y != _y)) {
+            i = (i + 1) & mask;
+        }
+
+        if (slots[i].count++ == 0) {
+            slots[i].x = _x;
+            slots[i].y = _y;
+            slots[i].head = -1;
+            slots[i].rank = occupied.size();
+            occupied.push_back(i);
+        }
+        return i;
+    }
+
+    // Doubles the table, keeping the slots in use in the same order
+    void grow() {
+        std::vector<Slot> old(std::max(slots.size() * 2, size_t(16)), Slot{0, 0, -1, 0, 0});
+        old.swap(slots);
+
+        size_t mask = slots.size() - 1;
+
+        for (int32_t& o : occupied) {
+            const Slot& slot = old[o];
+            size_t i = hash(slot.x, slot.y) & mask;
+
+            while (slots[i].count != 0) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = slot;
+            o = i;
+        }
+    }
+
+    void clearCells() {
+        // Only reset the slots used since the last clear
+        if (occupied.size() > slots.size() / 4) {
+            std::fill(slots.begin(), slots.end(), Slot{0, 0, -1, 0, 0});
+        } else {
+            for (int32_t o : occupied) {
+                slots[o].count = 0;
+            }
+        }
+        occupied.clear();
+        nodes.clear();
+        spans.clear();
+    }
+
+    void addToCells(int32_t _box, const CellSpan& _span) {
+        for (i32 y = _span.y1; y < _span.y2; y++) {
+            for (i32 x = _span.x1; x < _span.x2; x++) {
+                Slot& slot = slots[useSlot(x, y)];
+
+                nodes.push_back(Node{_box, slot.head});
+                slot.head = nodes.size() - 1;
+            }
+        }
+    }
+
+    int32_t place(const AABB<V>& _aabb, const CellSpan& _span) {
+        aabbs.push_back(_aabb);
+        int32_t index = aabbs.size() - 1;
+
+        spans.push_back(_span);
+        addToCells(index, _span);
+
+        return index;
+    }
+
+    // Returns false when _visit stopped the query
+    template<typename Visit>
+    bool query(const AABB<V>& _aabb, const CellSpan& _span, Visit& _visit) const {
+        for (i32 y = _span.y1; y < _span.y2; y++) {
+            for (i32 x = _span.x1; x < _span.x2; x++) {
+                int32_t slot = findSlot(x, y);
+                if (slot == -1) { continue; }
+
+                for (int32_t n = slots[slot].head; n != -1; n = nodes[n].next) {
+                    int32_t i = nodes[n].box;
+                    const CellSpan& so = spans[i];
+
+                    if (!ownsPair(_span, so, x, y)) {
+                        continue;
+                    }
+
+                    const auto& other = aabbs[i];
+
+                    if (_aabb.intersect(other) && !_visit(_aabb, other)) {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    /*
+     * Counting sort of _boxes into the cells, then test of the boxes of
+     * each cell in the order the cells were first used. The cells are
+     * cleared afterwards.
+     */
+    template<typename Boxes>
+    void collideAll(const Boxes& _boxes) {
+        clear();
+
+        spans.resize(_boxes.size());
+        entryCells.clear();
+
+        for (size_t i = 0; i < _boxes.size(); i++) {
+            const CellSpan& s = spans[i] = cellSpan(_boxes[i]);
+
+            for (i32 y = s.y1; y < s.y2; y++) {
+                for (i32 x = s.x1; x < s.x2; x++) {
+                    entryCells.push_back(slots[useSlot(x, y)].rank);
+                }
+            }
+        }
+
+        size_t cells = occupied.size();
+        cellOffsets.assign(cells + 1, 0);
+
+        for (int32_t c : entryCells) {
+            cellOffsets[c+1]++;
+        }
+        for (size_t c = 0; c < cells; c++) {
+            cellOffsets[c+1] += cellOffsets[c];
+        }
+
+        // The offsets are used as cursors, and end up shifted by one cell
+        cellIndices.resize(entryCells.size());
+
+        size_t e = 0;
+        for (size_t i = 0; i < _boxes.size(); i++) {
+            const CellSpan& s = spans[i];
+
+            // Empty boxes have inverted spans and no entries
+            size_t entries = size_t(std::max(s.x2 - s.x1, i32(0))) * size_t(std::max(s.y2 - s.y1, i32(0)));
+
+            for (size_t end = e + entries; e < end; e++) {
+                cellIndices[cellOffsets[entryCells[e]]++] = i;
+            }
+        }
+
+        int32_t begin = 0;
+
+        for (size_t c = 0; c < cells; c++) {
+            const Slot& slot = slots[occupied[c]];
+            const int32_t* v = cellIndices.data() + begin;
+            int32_t n = cellOffsets[c] - begin;
+            begin = cellOffsets[c];
+
+            for (int32_t j = 0; j + 1 < n; j++) {
+                int32_t a = v[j];
+                const CellSpan& sa = spans[a];
+                const auto& box = _boxes[a];
+
+                for (int32_t k = j + 1; k < n; k++) {
+                    int32_t b = v[k];
+                    const CellSpan& sb = spans[b];
+
+                    if (ownsPair(sa, sb, i32(slot.x), i32(slot.y)) && overlap(box, _boxes[b])) {
+                        pairs.push_back(Pair{a, b});
+                    }
+                }
+            }
+        }
+
+        clearCells();
+    }
+};
+
+}
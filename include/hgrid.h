@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "aabb.h"
+#include "isect2d.h"
+
+namespace isect2d {
+
+/*
+ * Hierarchical grid broadphase. Level 0 has the finest cells, and each
+ * following level doubles the cell size until one cell covers the whole
+ * resolution. A box is only binned at the level whose cells are at least
+ * as large as its extent, so it covers at most 2x2 cells whatever its size.
+ *
+ * Boxes of the same level are tested in the cells they share, and each box
+ * is tested against the boxes of the coarser levels in the cells it covers
+ * there. Pairs found in several cells are reported once, by the cell
+ * holding the min corner of their overlap.
+ */
+template<typename V>
+struct HGrid {
+    using Value = typename V::value_type;
+    using i32 = int_fast32_t;
+
+    // Colliding pairs of the last intersect(), first < second
+    std::vector<std::pair<int32_t, int32_t>> pairs;
+
+    // The default grid has a single cell holding every box, until resize()
+    HGrid(const V _resolution = V(1, 1), Value _cellSize = 1) {
+        resize(_resolution, _cellSize);
+    }
+
+    void resize(const V _resolution, Value _cellSize) {
+        levels.clear();
+
+        Value size = std::max(_cellSize, Value(1));
+        i32 base = 0;
+
+        while (true) {
+            Level level;
+            level.cellSize = size;
+            level.nx = std::max(i32(1), i32(std::ceil(_resolution.x / size)));
+            level.ny = std::max(i32(1), i32(std::ceil(_resolution.y / size)));
+            level.base = base;
+            levels.push_back(level);
+
+            base += level.nx * level.ny;
+
+            if (level.nx == 1 && level.ny == 1) {
+                break;
+            }
+            size *= 2;
+        }
+
+        cellOffsets.assign(base + 1, 0);
+    }
+
+    size_t getLevelCount() const {
+        return levels.size();
+    }
+
+    void intersect(const std::vector<AABB<V>>& _aabbs) {
+        pairs.clear();
+
+        build(_aabbs);
+
+        // Boxes against the boxes of their own level
+        for (const Level& level : levels) {
+            if (level.count == 0) { continue; }
+
+            for (i32 c = 0; c < level.nx * level.ny; c++) {
+                i32 cell = level.base + c;
+                i32 cx = c % level.nx;
+                i32 cy = c / level.nx;
+
+                for (i32 j = cellOffsets[cell]; j < cellOffsets[cell+1]; j++) {
+                    int32_t a = cellIndices[j];
+                    const Entry& ea = entries[a];
+
+                    for (i32 k = j + 1; k < cellOffsets[cell+1]; k++) {
+                        int32_t b = cellIndices[k];
+                        const Entry& eb = entries[b];
+
+                        if (ownsPair(ea, eb, cx, cy) && _aabbs[a].intersect(_aabbs[b])) {
+                            emit(a, b);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Boxes against the boxes of the coarser levels
+        for (size_t a = 0; a < _aabbs.size(); a++) {
+            const AABB<V>& aabb = _aabbs[a];
+
+            for (size_t l = entries[a].level + 1; l < levels.size(); l++) {
+                const Level& level = levels[l];
+                if (level.count == 0) { continue; }
+
+                Entry span = levelSpan(aabb, l);
+
+                for (i32 cy = span.y1; cy < span.y2; cy++) {
+                    for (i32 cx = span.x1; cx < span.x2; cx++) {
+                        i32 cell = level.base + cx + cy * level.nx;
+
+                        for (i32 k = cellOffsets[cell]; k < cellOffsets[cell+1]; k++) {
+                            int32_t b = cellIndices[k];
+                            const Entry& eb = entries[b];
+
+                            if (ownsPair(span, eb, cx, cy) && aabb.intersect(_aabbs[b])) {
+                                emit(a, b);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    struct Level {
+        Value cellSize;
+        i32 nx, ny;
+        // Index of the first cell of the level in cellOffsets
+        i32 base;
+        // Boxes binned at this level by the last intersect()
+        size_t count = 0;
+    };
+
+    // Level of a box and range of cells [x1, x2) x [y1, y2) it covers there
+    struct Entry {
+        int32_t level;
+        i32 x1, y1, x2, y2;
+    };
+
+    std::vector<Level> levels;
+    std::vector<Entry> entries;
+    std::vector<int32_t> cellOffsets;
+    std::vector<int32_t> cellIndices;
+    std::vector<int32_t> cellCursor;
+
+    void emit(int32_t _a, int32_t _b) {
+        pairs.emplace_back(std::min(_a, _b), std::max(_a, _b));
+    }
+
+    Entry levelSpan(const AABB<V>& _aabb, size_t _level) const {
+        const Level& level = levels[_level];
+
+        i32 x1 = _aabb.min.x / level.cellSize;
+        i32 y1 = _aabb.min.y / level.cellSize;
+        i32 x2 = _aabb.max.x / level.cellSize + 1;
+        i32 y2 = _aabb.max.y / level.cellSize + 1;
+
+        return { int32_t(_level),
+                 std::min(std::max(x1, i32(0)), level.nx - 1),
+                 std::min(std::max(y1, i32(0)), level.ny - 1),
+                 std::min(std::max(x2, i32(1)), level.nx),
+                 std::min(std::max(y2, i32(1)), level.ny) };
+    }
+
+    // Counting sort of the boxes into the cells of their level
+    void build(const std::vector<AABB<V>>& _aabbs) {
+        entries.resize(_aabbs.size());
+        std::fill(cellOffsets.begin(), cellOffsets.end(), 0);
+
+        for (Level& level : levels) {
+            level.count = 0;
+        }
+
+        for (size_t i = 0; i < _aabbs.size(); i++) {
+            const AABB<V>& aabb = _aabbs[i];
+            Value extent = std::max(aabb.max.x - aabb.min.x, aabb.max.y - aabb.min.y);
+
+            size_t l = 0;
+            while (l + 1 < levels.size() && levels[l].cellSize < extent) {
+                l++;
+            }
+
+            Entry e = levelSpan(aabb, l);
+            entries[i] = e;
+
+            Level& level = levels[l];
+            level.count++;
+
+            for (i32 y = e.y1; y < e.y2; y++) {
+                for (i32 x = e.x1; x < e.x2; x++) {
+                    cellOffsets[level.base + x + y * level.nx + 1]++;
+                }
+            }
+        }
+
+        size_t cells = cellOffsets.size() - 1;
+        for (size_t c = 0; c < cells; c++) {
+            cellOffsets[c+1] += cellOffsets[c];
+        }
+
+        cellIndices.resize(cellOffsets[cells]);
+        cellCursor.assign(cellOffsets.begin(), cellOffsets.end() - 1);
+
+        for (size_t i = 0; i < _aabbs.size(); i++) {
+            const Entry& e = entries[i];
+            const Level& level = levels[e.level];
+
+            for (i32 y = e.y1; y < e.y2; y++) {
+                for (i32 x = e.x1; x < e.x2; x++) {
+                    cellIndices[cellCursor[level.base + x + y * level.nx]++] = i;
+                }
+            }
+        }
+    }
+};
+
+}
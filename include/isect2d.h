@@ -4,13 +4,30 @@
 #include <set>
 #include <unordered_set>
 #include <vector>
+#include <cstdint>
 #include <array>
 #include <functional> // for hash function
+#include <limits>
+#include <memory>
 #include <algorithm> // for std::max
+#include <thread>
+#include <type_traits>
+#include <utility>
 
 #include "aabb.h"
+#include "allocator.h"
+#include "boxview.h"
 #include "obb.h"
+#include "soa.h"
 
+// Define ISECT2D_STATS to fill ISect2D::stats on each batch intersect().
+// Without it the counters are compiled out.
+#ifdef ISECT2D_STATS
+#include <chrono>
+#define ISECT2D_STAT(...) __VA_ARGS__
+#else
+#define ISECT2D_STAT(...)
+#endif
 
 namespace std {
     template <>
@@ -29,192 +46,1734 @@ static constexpr const T clamp(T val, T min, T max) {
          : val > max ? max : val;
 }
 
-template<typename V>
+static inline size_t nextPowerOfTwo(size_t _n) {
+    size_t p = 1;
+    while (p < _n) { p <<= 1; }
+    return p;
+}
+
+// Range of cells [x1, x2) x [y1, y2) covered by a box in a grid
+struct CellSpan {
+    int_fast32_t x1, y1, x2, y2;
+};
+
+/*
+ * Owner cell rule of the grids. Two boxes covering the cell spans _a and
+ * _b share all the cells of the overlap of their spans, and are only
+ * tested in the cell (_x, _y) holding its min corner, so that a pair is
+ * reported once.
+ */
+template<typename SpanA, typename SpanB, typename I>
+inline bool ownsPair(const SpanA& _a, const SpanB& _b, I _x, I _y) {
+    return std::max(_a.x1, _b.x1) == _x && std::max(_a.y1, _b.y1) == _y;
+}
+
+// Same test as AABB::intersect() on anything with min and max
+template<typename A, typename B>
+inline bool overlap(const A& _a, const B& _b) {
+    return _b.max.x >= _a.min.x &&
+           _b.max.y >= _a.min.y &&
+           _b.min.x <= _a.max.x &&
+           _b.min.y <= _a.max.y;
+}
+
+/*
+ * Pair of box indices, first < second, as written to the caller's buffer
+ * by the broadphases. 8 bytes per pair, in one contiguous array.
+ */
+struct IndexPair {
+    uint32_t first;
+    uint32_t second;
+};
+
+// Sorts _pairs by first then second box, so that a narrow-phase over them
+// reads the arrays of boxes mostly forward
+inline void sortPairs(std::vector<IndexPair>& _pairs) {
+    std::sort(_pairs.begin(), _pairs.end(), [](const IndexPair& _a, const IndexPair& _b) {
+        return (uint64_t(_a.first) << 32 | _a.second) < (uint64_t(_b.first) << 32 | _b.second);
+    });
+}
+
+/*
+ * Counters of the last batch intersect() of an ISect2D, filled when built
+ * with ISECT2D_STATS. Hits count every overlapping candidate pair found in
+ * the cells, including those rejected as duplicates by the pairMap or by
+ * the owner cell rule. Times are in milliseconds.
+ */
+struct Stats {
+    size_t boxes = 0;
+    // Boxes binned in the cells, summed over cells
+    size_t cellEntries = 0;
+    // Boxes entirely outside of the grid
+    size_t outsideBoxes = 0;
+
+    size_t cells = 0;
+    size_t usedCells = 0;
+    size_t maxOccupancy = 0;
+    // Mean boxes per used cell
+    float meanOccupancy = 0;
+    // Cells holding 0 boxes, then [1, 2), [2, 4), ... boxes, the last
+    // bucket holding all cells of 2^14 boxes or more
+    std::array<size_t, 16> occupancyHistogram{};
+
+    uint64_t candidateTests = 0;
+    uint64_t hits = 0;
+    uint64_t duplicates = 0;
+    size_t pairs = 0;
+
+    // pairMap lookups, chain links followed and longest chain followed
+    uint64_t hashLookups = 0;
+    uint64_t hashProbes = 0;
+    size_t maxChain = 0;
+
+    double fitMs = 0;
+    double binMs = 0;
+    double collideMs = 0;
+    double outsideMs = 0;
+    double totalMs = 0;
+};
+
+/*
+ * Grid broadphase. Its buffers use the allocator Alloc, see allocator.h
+ * for one checking that the steady state does not allocate.
+ */
+template<typename V, template<typename> class Alloc = std::allocator>
 struct ISect2D {
     using i32 = int_fast32_t;
 
-    struct Pair {
-    Pair(int _a, int _b, int _next) : first(_a), second(_b), next(_next) {}
-        int first;
-        int second;
+    template<typename T>
+    using Vector = std::vector<T, Alloc<T>>;
+
+    struct Pair {
+        Pair(int _a, int _b) : first(_a), second(_b) {}
+        int first;
+        int second;
+    };
+
+    // Default filter of the narrowphase intersect(), keeps every pair
+    struct AcceptAll {
+        bool operator()(int32_t, int32_t) const { return true; }
+    };
+
+    // Box found by nearest() or within(), as its index in aabbs
+    struct Neighbor {
+        int32_t index;
+        float distance;
+    };
+
+    using CellSpan = isect2d::CellSpan;
+
+    // Cell storage used by the batch intersect()
+    enum class Storage {
+        // One growable vector per cell (gridAABBs)
+        Buckets,
+        // Counting sort of the cell entries into one contiguous array
+        // (cellIndices), cell c owning [cellOffsets[c], cellOffsets[c+1])
+        Compact,
+    };
+
+    // How the batch intersect() reports once the pairs found in several cells
+    enum class Dedup {
+        // Pairs are looked up in the pairMap hash before being added. Each
+        // lookup is a cache miss once the pairs outgrow the caches, so with
+        // many pairs it is much slower than OwnerCell.
+        Hash,
+        // A pair is only reported by the cell holding the min corner of the
+        // overlap of both boxes. Needs no hash, the pairMap is released.
+        OwnerCell,
+    };
+
+    // Overlap test used for the pairs of a cell by the batch intersect()
+    enum class Kernel {
+        // AABB::intersect() on each candidate pair
+        Scalar,
+        // The cell bounds are gathered in an AABBSoA and each box is tested
+        // against simdWidth others at once. Bounds are compared as floats,
+        // integer coordinates of more than 24 bits, which floats do not
+        // hold exactly, are tested as by Scalar.
+        Batch,
+    };
+
+    // How the batch intersect() lays out its grid
+    enum class GridFit {
+        // As given to resize()
+        Manual,
+        // Refitted to the boxes on each call by fitGrid()
+        Statistics,
+        // As Statistics, with the cell size also corrected from the
+        // occupancy measured on the previous call
+        Adaptive,
+    };
+
+    i32 split_x = 0;
+    i32 split_y = 0;
+    i32 res_x = 0;
+    i32 res_y = 0;
+    i32 xpad = 0;
+    i32 ypad = 0;
+
+    // Min corner of the grid. Boxes outside of a grid set by resize() are
+    // clamped into its edge cells, the batch intersect() of a fitted grid
+    // tests them apart from the cells instead.
+    i32 origin_x = 0;
+    i32 origin_y = 0;
+
+    // log2 of xpad and ypad when they are powers of two, -1 otherwise.
+    // Integer coordinates are then turned into cells with a shift.
+    i32 xshift = -1;
+    i32 yshift = -1;
+
+    Storage storage = Storage::Buckets;
+    Dedup dedup = Dedup::Hash;
+    Kernel kernel = Kernel::Scalar;
+    GridFit gridFit = GridFit::Manual;
+
+    // Mean number of boxes per cell aimed at by fitGrid()
+    float targetOccupancy = 16.f;
+
+    // Number of tasks the cells are split into by the batch intersect(),
+    // 1 runs the broadphase on the calling thread
+    size_t threads = 1;
+
+    // Runs _count tasks, possibly concurrently, and returns once all of
+    // them are done. When empty, each task but the first runs on its own
+    // std::thread.
+    std::function<void(size_t _count, const std::function<void(size_t _task)>& _run)> scheduler;
+
+    // The pairMap doubles its bucket count whenever pairs exceed
+    // maxLoadFactor times the number of buckets
+    float maxLoadFactor = 1.f;
+
+    Vector<Vector<int32_t>> gridAABBs;
+    Vector<Pair> pairs;
+    Vector<int> pairMap;
+    Vector<AABB<V>> aabbs;
+
+    Vector<int32_t> cellOffsets;
+    Vector<int32_t> cellIndices;
+
+    // Pairs that started, kept on or stopped colliding between the two
+    // last calls to updatePairs(), as handles returned by add() with
+    // first < second. persistingPairs is only filled by updateFrame().
+    Vector<std::pair<int32_t, int32_t>> addedPairs;
+    Vector<std::pair<int32_t, int32_t>> persistingPairs;
+    Vector<std::pair<int32_t, int32_t>> removedPairs;
+
+#ifdef ISECT2D_STATS
+    // Counters of the last batch intersect()
+    Stats stats;
+#endif
+
+    // collisionHashSize is the initial bucket count of the pairMap, rounded
+    // up to a power of two. With 0 the pairMap is only allocated when the
+    // hash deduplication is used.
+    ISect2D(size_t collisionHashSize = 2048)
+        : hashSize(nextPowerOfTwo(collisionHashSize)) {
+        if (collisionHashSize > 0) {
+            pairMap.assign(hashSize, -1);
+        }
+    }
+
+    void resize(const V _split, const V _resolution, const V _origin = V(0, 0)) {
+        split_x = _split.x;
+        split_y = _split.y;
+        res_x = _resolution.x;
+        res_y = _resolution.y;
+        origin_x = std::floor(_origin.x);
+        origin_y = std::floor(_origin.y);
+
+        // Ensure no division by zero
+        split_x = std::max(split_x, static_cast<i32>(1));
+        split_y = std::max(split_y, static_cast<i32>(1));
+        res_x = std::max(res_x, split_x);
+        res_y = std::max(res_y, split_y);
+
+        xpad = res_x / split_x;
+        ypad = res_y / split_y;
+
+        xshift = shiftOf(xpad);
+        yshift = shiftOf(ypad);
+
+        growCells();
+    }
+
+    /*
+     * Sizes the buffers for calls with up to _boxes boxes, _pairs pairs and
+     * _entries cell entries (4 per box by default), so that they do not
+     * allocate. The buckets of Storage::Buckets, the bounds gathered by
+     * Kernel::Batch and the contacts of each handle grow with the fullest
+     * cell or handle instead, and keep their capacity: run a few frames to
+     * warm them up. Threads started without a scheduler also allocate.
+     */
+    void reserve(size_t _boxes, size_t _pairs, size_t _entries = 0) {
+        size_t entries = _entries > 0 ? _entries : 4 * _boxes;
+        // fitGrid() uses at most 4 cells per box
+        size_t cells = gridFit == GridFit::Manual ? size_t(split_x * split_y)
+                                                  : std::max(size_t(split_x * split_y), 4 * _boxes + 16);
+
+        aabbs.reserve(_boxes);
+        spans.reserve(_boxes);
+        outside.reserve(_boxes);
+        edges.reserve(_boxes);
+        sweep.reserve(_boxes);
+        fitValues.reserve(std::min(_boxes, size_t(8192)));
+        stamps.reserve(_boxes);
+
+        cellIndices.reserve(entries);
+        cellOffsets.reserve(cells + 1);
+        cellCursor.reserve(cells);
+        if (storage == Storage::Buckets && gridAABBs.size() < cells) {
+            gridAABBs.resize(cells);
+        }
+
+        pairs.reserve(_pairs);
+        if (dedup == Dedup::Hash) {
+            size_t buckets = nextPowerOfTwo(size_t(_pairs / maxLoadFactor) + 1);
+            if (pairMap.size() < buckets) {
+                rehash(buckets);
+            }
+            touchedBuckets.reserve(pairMap.size());
+            pairNext.reserve(_pairs);
+        }
+
+        contacts.reserve(_boxes);
+        handleState.reserve(_boxes);
+        dirtyHandles.reserve(_boxes);
+        freeHandles.reserve(_boxes);
+        removedHandles.reserve(_boxes);
+        addedPairs.reserve(_pairs);
+        persistingPairs.reserve(_pairs);
+        removedPairs.reserve(_pairs);
+        sortedPairs.reserve(_pairs);
+
+        if (threads > 1) {
+            taskBounds.reserve(threads + 1);
+            if (workerPairs.size() < threads) {
+                workerPairs.resize(threads);
+                workerBounds.resize(threads);
+                workerRejected.resize(threads);
+            }
+            for (auto& local : workerPairs) {
+                local.reserve(_pairs);
+            }
+        }
+    }
+
+    void clear() {
+        pairs.clear();
+        pairNext.clear();
+
+        // Only reset the buckets used since the last clear
+        if (touchedBuckets.size() > pairMap.size() / 4) {
+            pairMap.assign(pairMap.size(), -1);
+        } else {
+            for (int32_t key : touchedBuckets) {
+                pairMap[key] = -1;
+            }
+        }
+        touchedBuckets.clear();
+
+        aabbs.clear();
+
+        for (auto& grid : gridAABBs){
+            grid.clear();
+        }
+
+        addedPairs.clear();
+        persistingPairs.clear();
+        removedPairs.clear();
+        frameCount = 0;
+        contacts.clear();
+        handleState.clear();
+        dirtyHandles.clear();
+        freeHandles.clear();
+        removedHandles.clear();
+    }
+
+    template<typename Box>
+    CellSpan cellSpan(const Box& _aabb) const {
+        i32 x1 = cell(_aabb.min.x - origin_x, xpad, xshift);
+        i32 y1 = cell(_aabb.min.y - origin_y, ypad, yshift);
+        i32 x2 = cell(_aabb.max.x - origin_x, xpad, xshift) + 1;
+        i32 y2 = cell(_aabb.max.y - origin_y, ypad, yshift) + 1;
+
+        x1 = clamp(x1, i32(0), split_x-1);
+        y1 = clamp(y1, i32(0), split_y-1);
+        x2 = clamp(x2, i32(1), split_x);
+        y2 = clamp(y2, i32(1), split_y);
+
+        return { x1, y1, x2, y2 };
+    }
+
+    /*
+     * Fits the grid to the bounds of _boxes, leaving out about the outermost
+     * 0.1% of them on each side so that a few far away boxes do not stretch
+     * the cells. Cells are about as wide and high as the mean plus one standard
+     * deviation of the box extents, or larger so that a cell holds
+     * targetOccupancy boxes on average, and are not square when the boxes
+     * are not. The batch intersect() calls it unless gridFit is Manual.
+     */
+    template<typename Boxes>
+    void fitGrid(const Boxes& _boxes) {
+        double sw = 0, sh = 0, sw2 = 0, sh2 = 0, swh = 0;
+        size_t n = 0;
+
+        for (size_t i = 0; i < _boxes.size(); i++) {
+            const auto& box = _boxes[i];
+            double w = box.max.x - box.min.x;
+            double h = box.max.y - box.min.y;
+
+            // Skip empty boxes
+            if (!(w >= 0 && h >= 0)) { continue; }
+            n++;
+
+            sw += w;
+            sh += h;
+            sw2 += w * w;
+            sh2 += h * h;
+            swh += w * h;
+        }
+
+        if (n == 0) { return; }
+
+        double minx = fitBound(_boxes, X, false);
+        double miny = fitBound(_boxes, Y, false);
+        double maxx = fitBound(_boxes, X, true);
+        double maxy = fitBound(_boxes, Y, true);
+
+        // The quantiles of a few spread out boxes can cross
+        maxx = std::max(maxx, minx);
+        maxy = std::max(maxy, miny);
+
+        double width = std::max(maxx - minx, 1.0);
+        double height = std::max(maxy - miny, 1.0);
+
+        // Mean plus one standard deviation of the extents
+        double mw = sw / n;
+        double mh = sh / n;
+        double p = std::max(mw + std::sqrt(std::max(sw2 / n - mw * mw, 0.0)), 1.0);
+        double q = std::max(mh + std::sqrt(std::max(sh2 / n - mh * mh, 0.0)), 1.0);
+
+        // A box of extent (w, h) covers (w + cx) * (h + cy) / (cx * cy)
+        // cells on average, solve for cells (s * p, s * q) holding
+        // targetOccupancy boxes: sum((w + s p) (h + s q)) = target W H
+        double a = n * p * q;
+        double b = q * sw + p * sh;
+        double c = swh - targetOccupancy * width * height;
+        double scale = 0;
+
+        if (c < 0) {
+            scale = (-b + std::sqrt(b * b - 4 * a * c)) / (2 * a);
+        }
+        scale *= fitScale;
+
+        // Smaller cells than the boxes would only multiply the entries
+        fitFloored = scale < 1;
+        scale = std::max(scale, 1.0);
+
+        // Bound the cell count to a few per box
+        double cells = (width / (scale * p) + 1) * (height / (scale * q) + 1);
+        double maxCells = 4.0 * n + 16;
+        if (cells > maxCells) {
+            scale *= std::sqrt(cells / maxCells);
+        }
+
+        i32 cx = std::max(i32(std::ceil(scale * p)), i32(1));
+        i32 cy = std::max(i32(std::ceil(scale * q)), i32(1));
+
+        origin_x = std::floor(minx);
+        origin_y = std::floor(miny);
+        split_x = std::max(i32(std::floor(maxx - origin_x)) / cx + 1, i32(1));
+        split_y = std::max(i32(std::floor(maxy - origin_y)) / cy + 1, i32(1));
+        xpad = cx;
+        ypad = cy;
+        res_x = split_x * xpad;
+        res_y = split_y * ypad;
+
+        xshift = shiftOf(xpad);
+        yshift = shiftOf(ypad);
+
+        growCells();
+    }
+
+    /*
+     * Calls _visit(_aabb, other) once for each box of the grid intersecting
+     * _aabb, stops as soon as _visit returns false. Boxes sharing several
+     * cells with _aabb are only visited in the first one, by the owner cell
+     * rule. _aabb is then added to the grid when _insert is set, unless
+     * the visit was stopped.
+     */
+    template<typename Visit>
+    void intersect(const AABB<V>& _aabb, Visit&& _visit, bool _insert = true) {
+        CellSpan s = cellSpan(_aabb);
+
+        if (query(_aabb, s, _visit) && _insert) {
+            place(_aabb, s);
+        }
+    }
+
+    void intersect(const AABB<V>& _aabb,
+                   std::function<bool(const AABB<V>& _aabb, const AABB<V>& _other)> _cb,
+                   bool _insert = true) {
+
+        CellSpan s = cellSpan(_aabb);
+
+        if (query(_aabb, s, _cb) && _insert) {
+            place(_aabb, s);
+        }
+    }
+
+    void insert(const AABB<V>& _aabb) {
+        place(_aabb, cellSpan(_aabb));
+    }
+
+    /*
+     * Queries of the boxes in the grid, as added by insert(), the single-box
+     * intersect() or add(). _visit(index) is called once for each box hit,
+     * with its index in aabbs, and the query stops as soon as _visit returns
+     * false, in which case false is returned. Only the cells covered by the
+     * query are visited.
+     */
+    template<typename Visit>
+    bool queryPoint(const V& _point, Visit&& _visit) const {
+        return queryRect(AABB<V>(_point.x, _point.y, _point.x, _point.y), _visit);
+    }
+
+    template<typename Visit>
+    bool queryRect(const AABB<V>& _rect, Visit&& _visit) const {
+        auto visit = [&](const AABB<V>&, const AABB<V>& _other) {
+            return _visit(int32_t(&_other - aabbs.data()));
+        };
+        return query(_rect, cellSpan(_rect), visit);
+    }
+
+    /*
+     * Boxes crossed by the segment [_a, _b], visiting the cells along the
+     * segment in order. The cells are walked with a DDA clamped to the
+     * grid, so that a ray is a segment to any far enough point and costs
+     * no more than split_x + split_y cells.
+     */
+    template<typename Visit>
+    bool querySegment(const V& _a, const V& _b, Visit&& _visit) const {
+        // In cell units from the grid origin
+        double ax = (double(_a.x) - origin_x) / xpad;
+        double ay = (double(_a.y) - origin_y) / ypad;
+        double dx = (double(_b.x) - origin_x) / xpad - ax;
+        double dy = (double(_b.y) - origin_y) / ypad - ay;
+
+        CellSpan s = cellSpan(AABB<V>(_a.x, _a.y, _a.x, _a.y));
+        i32 x = s.x1;
+        i32 y = s.y1;
+        i32 sx = dx > 0 ? 1 : dx < 0 ? -1 : 0;
+        i32 sy = dy > 0 ? 1 : dy < 0 ? -1 : 0;
+
+        double tx = nextBoundary(ax, dx, x, split_x);
+        double ty = nextBoundary(ay, dy, y, split_y);
+
+        // A box is reported in the first cell of its span along the
+        // segment, the cells walked in its span being contiguous
+        i32 px = -1;
+        i32 py = -1;
+
+        while (true) {
+            for (int32_t i : gridAABBs[x + y * split_x]) {
+                const CellSpan& so = spans[i];
+
+                if (px >= so.x1 && px < so.x2 && py >= so.y1 && py < so.y2) {
+                    continue;
+                }
+                if (segmentOverlap(_a, _b, aabbs[i]) && !_visit(i)) {
+                    return false;
+                }
+            }
+
+            if (tx > 1 && ty > 1) { break; }
+
+            px = x;
+            py = y;
+
+            if (tx < ty) {
+                x += sx;
+                tx = nextBoundary(ax, dx, x, split_x);
+            } else {
+                y += sy;
+                ty = nextBoundary(ay, dy, y, split_y);
+            }
+        }
+        return true;
+    }
+
+    /*
+     * The _k boxes of the grid nearest to _point and no further than
+     * _maxDistance, by increasing distance to their AABB, 0 for those
+     * containing _point. The cells are searched ring by ring around the
+     * cell of _point, until the next ring is further than the _kth box.
+     */
+    void nearest(const V& _point, size_t _k, std::vector<Neighbor>& _result,
+                 float _maxDistance = std::numeric_limits<float>::infinity()) const {
+        searchRings(_point, _k, _maxDistance, _result, [&](int32_t _i, float) {
+            return boxDistance(_point, aabbs[_i]);
+        });
+    }
+
+    /*
+     * Same as above, by distance to _obbs, the OBBs or CompactOBBs of the
+     * boxes in aabbs. The distance is only computed for the boxes whose
+     * AABB, which bounds the OBB, is closer than the current _kth box.
+     */
+    template<typename O>
+    void nearest(const V& _point, size_t _k, const std::vector<O>& _obbs,
+                 std::vector<Neighbor>& _result,
+                 float _maxDistance = std::numeric_limits<float>::infinity()) const {
+        searchRings(_point, _k, _maxDistance, _result, [&](int32_t _i, float _bound) {
+            if (boxDistance(_point, aabbs[_i]) > _bound) {
+                return std::numeric_limits<float>::infinity();
+            }
+            return distance(_obbs[_i], _point);
+        });
+    }
+
+    // All the boxes of the grid within _radius of _point, by increasing
+    // distance to their AABB
+    void within(const V& _point, float _radius, std::vector<Neighbor>& _result) const {
+        searchRegion(_point, _radius, _result, [&](int32_t _i) {
+            return boxDistance(_point, aabbs[_i]);
+        });
+    }
+
+    // Same as above, by distance to _obbs
+    template<typename O>
+    void within(const V& _point, float _radius, const std::vector<O>& _obbs,
+                std::vector<Neighbor>& _result) const {
+        searchRegion(_point, _radius, _result, [&](int32_t _i) {
+            return distance(_obbs[_i], _point);
+        });
+    }
+
+    /*
+     * Same queries, with the boxes hit further tested against _obbs, the
+     * OBBs or CompactOBBs of the boxes in aabbs, by intersect() with an
+     * OBB made of the point, rectangle or segment
+     */
+    template<typename O, typename Visit>
+    bool queryPoint(const V& _point, const std::vector<O>& _obbs, Visit&& _visit) const {
+        O probe(_point, V(1, 0), 0, 0);
+
+        return queryPoint(_point, [&](int32_t _i) {
+            return !isect2d::intersect(probe, _obbs[_i]) || _visit(_i);
+        });
+    }
+
+    template<typename O, typename Visit>
+    bool queryRect(const AABB<V>& _rect, const std::vector<O>& _obbs, Visit&& _visit) const {
+        O probe((_rect.min + _rect.max) * 0.5, V(1, 0),
+                _rect.max.x - _rect.min.x, _rect.max.y - _rect.min.y);
+
+        return queryRect(_rect, [&](int32_t _i) {
+            return !isect2d::intersect(probe, _obbs[_i]) || _visit(_i);
+        });
+    }
+
+    template<typename O, typename Visit>
+    bool querySegment(const V& _a, const V& _b, const std::vector<O>& _obbs, Visit&& _visit) const {
+        V d = _b - _a;
+        float length = std::sqrt(d.x * d.x + d.y * d.y);
+        O probe((_a + _b) * 0.5, length > 0 ? d * (1 / length) : V(1, 0), length, 0);
+
+        return querySegment(_a, _b, [&](int32_t _i) {
+            return !isect2d::intersect(probe, _obbs[_i]) || _visit(_i);
+        });
+    }
+
+    /*
+     * Persistent use of the grid: boxes are added once and then moved or
+     * removed through their handle, which stays valid until remove() or
+     * clear(). Only the cells covered by the old and new spans of a box
+     * are touched. updatePairs() then refreshes the pairs of the boxes
+     * changed since its previous call only.
+     */
+    int32_t add(const AABB<V>& _aabb) {
+        CellSpan s = cellSpan(_aabb);
+        int32_t handle;
+
+        if (freeHandles.empty()) {
+            handle = place(_aabb, s);
+        } else {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+
+            aabbs[handle] = _aabb;
+            spans[handle] = s;
+            addToCells(handle, s);
+        }
+
+        if (contacts.size() < aabbs.size()) {
+            contacts.resize(aabbs.size());
+            handleState.resize(aabbs.size(), 0);
+        }
+        handleState[handle] = 0;
+        markDirty(handle);
+
+        return handle;
+    }
+
+    void update(int32_t _handle, const AABB<V>& _aabb) {
+        CellSpan s = cellSpan(_aabb);
+        CellSpan old = spans[_handle];
+
+        aabbs[_handle] = _aabb;
+
+        if (s.x1 != old.x1 || s.y1 != old.y1 || s.x2 != old.x2 || s.y2 != old.y2) {
+            // Leave the cells outside of the new span, join the new ones
+            for (i32 y = old.y1; y < old.y2; y++) {
+                for (i32 x = old.x1; x < old.x2; x++) {
+                    if (x < s.x1 || x >= s.x2 || y < s.y1 || y >= s.y2) {
+                        removeFromCell(x + y * split_x, _handle);
+                    }
+                }
+            }
+            for (i32 y = s.y1; y < s.y2; y++) {
+                for (i32 x = s.x1; x < s.x2; x++) {
+                    if (x < old.x1 || x >= old.x2 || y < old.y1 || y >= old.y2) {
+                        gridAABBs[x + y * split_x].push_back(_handle);
+                    }
+                }
+            }
+            spans[_handle] = s;
+        }
+
+        markDirty(_handle);
+    }
+
+    void remove(int32_t _handle) {
+        const CellSpan& s = spans[_handle];
+
+        for (i32 y = s.y1; y < s.y2; y++) {
+            for (i32 x = s.x1; x < s.x2; x++) {
+                removeFromCell(x + y * split_x, _handle);
+            }
+        }
+
+        // The handle is recycled once its pairs are reported as removed
+        handleState[_handle] |= Removed;
+        removedHandles.push_back(_handle);
+        markDirty(_handle);
+    }
+
+    /*
+     * Frame coherent use of the handles, where box i of _aabbs is handle i.
+     * Only the boxes changed since the previous call are updated, and boxes
+     * are added or removed at the end when their count changes, before
+     * updatePairs() is run. Cells are then only touched by the boxes whose
+     * span changed, and pairs only tested for the boxes that moved. The
+     * pairs still colliding are then listed in persistingPairs, which costs
+     * a pass over the contacts of all the handles. Not to be mixed with
+     * add() and remove().
+     */
+    void updateFrame(const std::vector<AABB<V>>& _aabbs) {
+        int32_t count = _aabbs.size();
+
+        // Removed last first, so that add() then takes the lowest handles
+        for (int32_t h = frameCount - 1; h >= count; h--) {
+            remove(h);
+        }
+        for (int32_t h = 0; h < std::min(count, frameCount); h++) {
+            if (!(aabbs[h] == _aabbs[h])) {
+                update(h, _aabbs[h]);
+            }
+        }
+        for (int32_t h = frameCount; h < count; h++) {
+            add(_aabbs[h]);
+        }
+        frameCount = count;
+
+        updatePairs();
+
+        sortedPairs.assign(addedPairs.begin(), addedPairs.end());
+        std::sort(sortedPairs.begin(), sortedPairs.end());
+
+        for (int32_t handle = 0; handle < int32_t(contacts.size()); handle++) {
+            for (int32_t other : contacts[handle]) {
+                if (other > handle && !std::binary_search(sortedPairs.begin(), sortedPairs.end(),
+                                                          std::make_pair(handle, other))) {
+                    persistingPairs.emplace_back(handle, other);
+                }
+            }
+        }
+    }
+
+    /*
+     * Collects the pairs of the handles added, updated or removed since the
+     * last call in addedPairs and removedPairs. Its cost only depends on
+     * these handles, persistingPairs is left empty.
+     */
+    void updatePairs() {
+        addedPairs.clear();
+        persistingPairs.clear();
+        removedPairs.clear();
+
+        for (int32_t handle : dirtyHandles) {
+            handleState[handle] &= ~Dirty;
+
+            auto& current = contacts[handle];
+            found.clear();
+
+            if (!(handleState[handle] & Removed)) {
+                const AABB<V>& aabb = aabbs[handle];
+                const CellSpan& s = spans[handle];
+
+                for (i32 y = s.y1; y < s.y2; y++) {
+                    for (i32 x = s.x1; x < s.x2; x++) {
+                        for (int32_t other : gridAABBs[x + y * split_x]) {
+                            const CellSpan& so = spans[other];
+
+                            // Only test other in the first cell both share
+                            if (other == handle ||
+                                !ownsPair(s, so, x, y)) {
+                                continue;
+                            }
+                            if (aabb.intersect(aabbs[other])) {
+                                found.push_back(other);
+                            }
+                        }
+                    }
+                }
+                std::sort(found.begin(), found.end());
+            }
+
+            for (int32_t other : current) {
+                if (!std::binary_search(found.begin(), found.end(), other)) {
+                    eraseSorted(contacts[other], handle);
+                    removedPairs.emplace_back(std::min(handle, other), std::max(handle, other));
+                }
+            }
+            for (int32_t other : found) {
+                if (!std::binary_search(current.begin(), current.end(), other)) {
+                    insertSorted(contacts[other], handle);
+                    addedPairs.emplace_back(std::min(handle, other), std::max(handle, other));
+                }
+            }
+            // Copied rather than swapped, so that each handle keeps its capacity
+            current.assign(found.begin(), found.end());
+        }
+        dirtyHandles.clear();
+
+        for (int32_t handle : removedHandles) {
+            contacts[handle].clear();
+            handleState[handle] = 0;
+            freeHandles.push_back(handle);
+        }
+        removedHandles.clear();
+    }
+
+    // Handles currently colliding with _handle, as of the last updatePairs()
+    const Vector<int32_t>& getContacts(int32_t _handle) const {
+        return contacts[_handle];
+    }
+
+/*
+ * Performs broadphase collision detection on _aabbs dividing the
+ * screen size _resolution by _split on X and Y dimension Returns the
+ * set of colliding pairs in the _aabbs container
+ */
+   void intersect(const std::vector<AABB<V>>& _aabbs) {
+      collideAll(_aabbs);
+   }
+
+    // Same as above on boxes read in place from user memory
+    template<typename T, typename Get>
+    void intersect(const BoxView<T, Get>& _boxes) {
+        collideAll(_boxes);
+    }
+
+    /*
+     * Broadphase and narrowphase in one pass over the cells. Each pair
+     * (a, b), a < b, whose AABBs intersect goes through _filter(a, b), then
+     * through _narrow(a, b) while the cell is still hot, and is added to
+     * pairs when both return true. Pairs are made unique by the owner cell
+     * rule, so _narrow runs once per pair whatever dedup is set to.
+     *
+     * Runs on the calling thread, threads and scheduler are ignored.
+     */
+    template<typename Narrow, typename Filter = AcceptAll>
+    void intersect(const std::vector<AABB<V>>& _aabbs, Narrow&& _narrow,
+                   Filter&& _filter = Filter()) {
+        collideNarrow(_aabbs, _narrow, _filter);
+    }
+
+    template<typename T, typename Get, typename Narrow, typename Filter = AcceptAll>
+    void intersect(const BoxView<T, Get>& _boxes, Narrow&& _narrow,
+                   Filter&& _filter = Filter()) {
+        collideNarrow(_boxes, _narrow, _filter);
+    }
+
+    /*
+     * Writes the pairs of the last intersect() to _out, sorted by first
+     * then second box when _sorted is set. _out keeps its capacity from
+     * one call to the next.
+     */
+    void getPairs(std::vector<IndexPair>& _out, bool _sorted = false) const {
+        _out.resize(pairs.size());
+
+        for (size_t i = 0; i < pairs.size(); i++) {
+            _out[i] = IndexPair{ uint32_t(pairs[i].first), uint32_t(pairs[i].second) };
+        }
+
+        if (_sorted) {
+            sortPairs(_out);
+        }
+    }
+
+private:
+    enum HandleState : uint8_t {
+        Dirty = 1,
+        Removed = 2,
+    };
+
+    size_t hashSize;
+    // Correction of the cell size learnt by adapt()
+    double fitScale = 1;
+    bool fitFloored = false;
+    Vector<double> fitValues;
+
+    // Boxes of the batch intersect() entirely and partly outside the grid
+    Vector<int32_t> outside;
+    Vector<int32_t> edges;
+    // Outside and edge boxes sorted by collideOutside()
+    Vector<int32_t> sweep;
+    Vector<Vector<int32_t>> contacts;
+    Vector<uint8_t> handleState;
+    Vector<int32_t> dirtyHandles;
+    Vector<int32_t> freeHandles;
+    Vector<int32_t> removedHandles;
+    Vector<int32_t> found;
+    mutable Vector<uint32_t> stamps;
+    mutable uint32_t stamp = 0;
+    Vector<std::pair<int32_t, int32_t>> sortedPairs;
+    // Boxes of the last updateFrame()
+    int32_t frameCount = 0;
+    Vector<int32_t> touchedBuckets;
+    // Next pair of the same pairMap bucket for each pair, -1 ends a chain
+    Vector<int32_t> pairNext;
+    Vector<CellSpan> spans;
+    Vector<int32_t> cellCursor;
+    Vector<Vector<std::pair<int32_t, int32_t>>> workerPairs;
+    using CellBounds = BasicAABBSoA<Alloc<float>>;
+    CellBounds cellBounds;
+    Vector<CellBounds> workerBounds;
+    // Owner cell rejections of each task of collideParallel(), summed
+    // into stats once the tasks are done
+    Vector<uint64_t> workerRejected;
+    // First cell of each task of collideParallel()
+    Vector<i32> taskBounds;
+
+    static i32 shiftOf(i32 _pad) {
+        i32 shift = 0;
+        while ((i32(1) << shift) < _pad) { shift++; }
+        return (i32(1) << shift) == _pad ? shift : -1;
+    }
+
+    // Cell of coordinate _v, before clamping to the grid. Negative
+    // coordinates may be rounded either way as they end up in the first
+    // cell, and floats are bounded so that empty AABB() stay convertible.
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value, i32>::type
+    cell(T _v, i32 _pad, i32 _shift) {
+        return _shift >= 0 ? i32(_v) >> _shift : i32(_v) / _pad;
+    }
+
+    template<typename T>
+    static typename std::enable_if<!std::is_integral<T>::value, i32>::type
+    cell(T _v, i32 _pad, i32) {
+        return std::max(std::min(_v / _pad, T(1 << 30)), T(-1));
+    }
+
+    // 0.1% quantile of the mins, or 99.9% of the maxs with _max, of the
+    // non empty _boxes along _axis. Estimated on a sample of at most 4096
+    // boxes, boxes beyond the fitted grid being handled anyway. Samples of
+    // less than 1000 boxes have no outliers to leave out, the exact bound
+    // of all the boxes is returned instead.
+    template<typename Boxes>
+    double fitBound(const Boxes& _boxes, Dimension _axis, bool _max) {
+        fitValues.clear();
+
+        size_t stride = std::max(_boxes.size() / 4096, size_t(1));
+
+        for (size_t i = 0; i < _boxes.size(); i += stride) {
+            const auto& box = _boxes[i];
+
+            if (box.max.x >= box.min.x && box.max.y >= box.min.y) {
+                double v = _axis == X ? (_max ? box.max.x : box.min.x)
+                                      : (_max ? box.max.y : box.min.y);
+                fitValues.push_back(_max ? -v : v);
+            }
+        }
+
+        if (fitValues.size() < 1000) {
+            double bound = std::numeric_limits<double>::max();
+
+            for (size_t i = 0; i < _boxes.size(); i++) {
+                const auto& box = _boxes[i];
+
+                if (box.max.x >= box.min.x && box.max.y >= box.min.y) {
+                    double v = _axis == X ? (_max ? box.max.x : box.min.x)
+                                          : (_max ? box.max.y : box.min.y);
+                    bound = std::min(bound, _max ? -v : v);
+                }
+            }
+            return _max ? -bound : bound;
+        }
+
+        size_t k = fitValues.size() / 1000;
+
+        std::nth_element(fitValues.begin(), fitValues.begin() + k, fitValues.end());
+        return _max ? -fitValues[k] : fitValues[k];
+    }
+
+    // Returns false when _visit stopped the query
+    template<typename Visit>
+    bool query(const AABB<V>& _aabb, const CellSpan& _span, Visit& _visit) const {
+        for (i32 y = _span.y1; y < _span.y2; y++) {
+            for (i32 x = _span.x1; x < _span.x2; x++) {
+                for (int32_t i : gridAABBs[x + y * split_x]) {
+                    const CellSpan& so = spans[i];
+
+                    if (!ownsPair(_span, so, x, y)) {
+                        continue;
+                    }
+
+                    const auto& other = aabbs[i];
+
+                    if (_aabb.intersect(other) && !_visit(_aabb, other)) {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    static bool closer(const Neighbor& _a, const Neighbor& _b) {
+        return _a.distance < _b.distance ||
+               (_a.distance == _b.distance && _a.index < _b.index);
+    }
+
+    template<typename Box>
+    static float boxDistance(const V& _point, const Box& _box) {
+        float x = std::max({ float(_box.min.x - _point.x), float(_point.x - _box.max.x), 0.f });
+        float y = std::max({ float(_box.min.y - _point.y), float(_point.y - _box.max.y), 0.f });
+
+        return std::sqrt(x * x + y * y);
+    }
+
+    /*
+     * Keeps the _k boxes of least _distance(index, bound) in a max heap,
+     * where bound is the distance of the _kth box so far. Rings of cells
+     * at Chebyshev distance r from the cell of _point are searched while
+     * they may hold a closer box. A box of ring r > 0 is at least r - 1
+     * cells away, plus the distance from _point to the sides of its cell.
+     * Boxes outside of the grid are clamped into closer rings, not further.
+     */
+    template<typename Distance>
+    void searchRings(const V& _point, size_t _k, float _maxDistance,
+                     std::vector<Neighbor>& _result, Distance&& _distance) const {
+        _result.clear();
+        if (_k == 0 || aabbs.empty()) { return; }
+
+        uint32_t stamp = nextStamp();
+
+        CellSpan s = cellSpan(AABB<V>(_point.x, _point.y, _point.x, _point.y));
+        i32 cx = s.x1;
+        i32 cy = s.y1;
+
+        // Distance from _point to the sides of its cell, when inside of it
+        double px = double(_point.x) - origin_x - double(cx) * xpad;
+        double py = double(_point.y) - origin_y - double(cy) * ypad;
+        double inner = std::min({ px, xpad - px, py, ypad - py });
+        inner = std::max(inner, 0.0);
+
+        i32 rings = std::max({ cx, split_x - 1 - cx, cy, split_y - 1 - cy });
+
+        auto visit = [&](i32 _x, i32 _y) {
+            for (int32_t i : gridAABBs[_x + _y * split_x]) {
+                if (stamps[i] == stamp) { continue; }
+                stamps[i] = stamp;
+
+                float bound = _result.size() == _k ? _result.front().distance : _maxDistance;
+                Neighbor n{ i, _distance(i, bound) };
+
+                if (!(n.distance <= _maxDistance)) { continue; }
+
+                if (_result.size() < _k) {
+                    _result.push_back(n);
+                    std::push_heap(_result.begin(), _result.end(), closer);
+                } else if (closer(n, _result.front())) {
+                    std::pop_heap(_result.begin(), _result.end(), closer);
+                    _result.back() = n;
+                    std::push_heap(_result.begin(), _result.end(), closer);
+                }
+            }
+        };
+
+        for (i32 r = 0; r <= rings; r++) {
+            double ring = r == 0 ? 0 : (r - 1) * double(std::min(xpad, ypad)) + inner;
+
+            if (ring > _maxDistance ||
+                (_result.size() == _k && ring > _result.front().distance)) {
+                break;
+            }
+
+            for (i32 y = std::max(cy - r, i32(0)); y <= std::min(cy + r, split_y - 1); y++) {
+                if (y == cy - r || y == cy + r) {
+                    for (i32 x = std::max(cx - r, i32(0)); x <= std::min(cx + r, split_x - 1); x++) {
+                        visit(x, y);
+                    }
+                } else {
+                    if (cx - r >= 0) { visit(cx - r, y); }
+                    if (r > 0 && cx + r < split_x) { visit(cx + r, y); }
+                }
+            }
+        }
 
-        int next;
-    };
+        std::sort_heap(_result.begin(), _result.end(), closer);
+    }
 
-    i32 split_x = 0;
-    i32 split_y = 0;
-    i32 res_x = 0;
-    i32 res_y = 0;
-    i32 xpad = 0;
-    i32 ypad = 0;
+    // Boxes of the cells covering the square of _radius around _point,
+    // kept when their _distance(index) is at most _radius
+    template<typename Distance>
+    void searchRegion(const V& _point, float _radius, std::vector<Neighbor>& _result,
+                      Distance&& _distance) const {
+        _result.clear();
 
-    std::vector<std::vector<int32_t>> gridAABBs;
-    std::vector<Pair> pairs;
-    std::vector<int> pairMap;
-    std::vector<AABB<V>> aabbs;
+        AABB<V> region(std::floor(_point.x - _radius), std::floor(_point.y - _radius),
+                       std::ceil(_point.x + _radius), std::ceil(_point.y + _radius));
 
-    ISect2D(size_t collisionHashSize = 2048) {
-        pairMap.assign(collisionHashSize, -1);
+        queryRect(region, [&](int32_t _i) {
+            float d = _distance(_i);
+            if (d <= _radius) {
+                _result.push_back(Neighbor{ _i, d });
+            }
+            return true;
+        });
+
+        std::sort(_result.begin(), _result.end(), closer);
     }
 
-    void resize(const V _split, const V _resolution) {
-        split_x = _split.x;
-        split_y = _split.y;
-        res_x = _resolution.x;
-        res_y = _resolution.y;
+    // Marks the boxes visited by a query, without clearing the marks of the
+    // previous ones
+    uint32_t nextStamp() const {
+        stamps.resize(aabbs.size(), 0);
 
-        // Ensure no division by zero
-        split_x = std::max(split_x, static_cast<i32>(1));
-        split_y = std::max(split_y, static_cast<i32>(1));
-        res_x = std::max(res_x, split_x);
-        res_y = std::max(res_y, split_y);
+        if (++stamp == 0) {
+            std::fill(stamps.begin(), stamps.end(), 0);
+            stamp = 1;
+        }
+        return stamp;
+    }
 
-        xpad = res_x / split_x;
-        ypad = res_y / split_y;
+    // Parameter along a segment of the next boundary it crosses between the
+    // cells of one axis from _cell, or infinity. Boxes outside of the grid
+    // are clamped into its edge cells, so its outer boundaries are not
+    // crossed.
+    static double nextBoundary(double _origin, double _delta, i32 _cell, i32 _cells) {
+        if (_delta > 0 && _cell < _cells - 1) {
+            return (_cell + 1 - _origin) / _delta;
+        }
+        if (_delta < 0 && _cell > 0) {
+            return (_cell - _origin) / _delta;
+        }
+        return std::numeric_limits<double>::infinity();
+    }
 
-        gridAABBs.resize(split_x * split_y);
+    // Whether the segment [_a, _b] intersects _box, by clipping the segment
+    // to the slabs of both axes
+    static bool segmentOverlap(const V& _a, const V& _b, const AABB<V>& _box) {
+        double t0 = 0;
+        double t1 = 1;
+
+        return clipSlab(_a.x, double(_b.x) - _a.x, _box.min.x, _box.max.x, t0, t1) &&
+               clipSlab(_a.y, double(_b.y) - _a.y, _box.min.y, _box.max.y, t0, t1);
     }
 
-    void clear() {
-        pairs.clear();
-        pairMap.assign(pairMap.size(), -1);
+    static bool clipSlab(double _p, double _d, double _min, double _max, double& _t0, double& _t1) {
+        if (_d == 0) {
+            return _p >= _min && _p <= _max;
+        }
 
-        aabbs.clear();
+        double u = (_min - _p) / _d;
+        double w = (_max - _p) / _d;
+        if (u > w) { std::swap(u, w); }
 
-        for (auto& grid : gridAABBs){
-            grid.clear();
+        _t0 = std::max(_t0, u);
+        _t1 = std::min(_t1, w);
+        return _t0 <= _t1;
+    }
+
+    int32_t place(const AABB<V>& _aabb, const CellSpan& _span) {
+        aabbs.push_back(_aabb);
+        int32_t index = aabbs.size() - 1;
+
+        spans.resize(aabbs.size());
+        spans[index] = _span;
+        addToCells(index, _span);
+
+        return index;
+    }
+
+    void addToCells(int32_t _index, const CellSpan& _span) {
+        for (i32 y = _span.y1; y < _span.y2; y++) {
+            for (i32 x = _span.x1; x < _span.x2; x++) {
+                gridAABBs[x + y * split_x].push_back(_index);
+            }
         }
     }
 
-    void intersect(const AABB<V>& _aabb,
-                   std::function<bool(const AABB<V>& _aabb, const AABB<V>& _other)> _cb,
-                   bool _insert = true) {
+    void removeFromCell(i32 _cell, int32_t _index) {
+        auto& v = gridAABBs[_cell];
+        auto it = std::find(v.begin(), v.end(), _index);
 
-        i32 x1 = _aabb.min.x / xpad;
-        i32 y1 = _aabb.min.y / ypad;
-        i32 x2 = _aabb.max.x / xpad + 1;
-        i32 y2 = _aabb.max.y / ypad + 1;
+        *it = v.back();
+        v.pop_back();
+    }
 
-        x1 = clamp(x1, i32(0), split_x-1);
-        y1 = clamp(y1, i32(0), split_y-1);
-        x2 = clamp(x2, i32(1), split_x);
-        y2 = clamp(y2, i32(1), split_y);
+    void markDirty(int32_t _handle) {
+        if (!(handleState[_handle] & Dirty)) {
+            handleState[_handle] |= Dirty;
+            dirtyHandles.push_back(_handle);
+        }
+    }
 
-        for (i32 y = y1; y < y2; y++) {
-            for (i32 x = x1; x < x2; x++) {
+    static void insertSorted(Vector<int32_t>& _v, int32_t _value) {
+        _v.insert(std::lower_bound(_v.begin(), _v.end(), _value), _value);
+    }
 
-                auto& v = gridAABBs[x + y * split_x];
+    static void eraseSorted(Vector<int32_t>& _v, int32_t _value) {
+        _v.erase(std::lower_bound(_v.begin(), _v.end(), _value));
+    }
 
-                for (int32_t i : v) {
-                    const auto& other = aabbs[i];
+    const int32_t* cellEntries(i32 _cell, size_t& _count) const {
+        if (storage == Storage::Compact) {
+            _count = cellOffsets[_cell+1] - cellOffsets[_cell];
+            return cellIndices.data() + cellOffsets[_cell];
+        }
+        _count = gridAABBs[_cell].size();
+        return gridAABBs[_cell].data();
+    }
 
-                    if (_aabb.intersect(other)) {
-                        if (!_cb(_aabb, other)) {
-                            return;
-                        }
+    template<typename Boxes>
+    void collideAll(const Boxes& _boxes) {
+        ISECT2D_STAT(auto start = std::chrono::steady_clock::now(); auto time = start);
+        clear();
+
+        if (gridFit != GridFit::Manual) {
+            fitGrid(_boxes);
+        }
+        ISECT2D_STAT(stats = Stats(); stats.fitMs = lap(time));
+
+        if (dedup == Dedup::OwnerCell) {
+            Vector<int>().swap(pairMap);
+            Vector<int32_t>().swap(touchedBuckets);
+            Vector<int32_t>().swap(pairNext);
+        } else if (pairMap.empty()) {
+            pairMap.assign(hashSize, -1);
+        }
+
+        bin(_boxes);
+        ISECT2D_STAT(stats.binMs = lap(time); countCells(_boxes.size()));
+
+        i32 cells = split_x * split_y;
+        bool owner = dedup == Dedup::OwnerCell;
+
+        uint64_t rejected = 0;
+
+        if (threads > 1) {
+            collideParallel(_boxes);
+        } else if (owner) {
+            collideCells(_boxes, 0, cells, owner, cellBounds, rejected, [this](int32_t _a, int32_t _b) {
+                pairs.push_back(Pair{_a, _b});
+            });
+        } else {
+            collideCells(_boxes, 0, cells, owner, cellBounds, rejected, [this](int32_t _a, int32_t _b) {
+                addPair(_a, _b);
+            });
+        }
+        ISECT2D_STAT(stats.duplicates += rejected);
+        ISECT2D_STAT(stats.collideMs = lap(time));
+
+        collideOutside(_boxes, [this](int32_t _a, int32_t _b) {
+            pairs.push_back(Pair{_a, _b});
+        });
+        ISECT2D_STAT(stats.outsideMs = lap(time));
+
+        if (gridFit == GridFit::Adaptive) {
+            adapt();
+        }
+
+        unbin();
+        ISECT2D_STAT(stats.pairs = pairs.size();
+                     stats.hits = pairs.size() + stats.duplicates;
+                     stats.totalMs = lap(start));
+    }
+
+    template<typename Boxes, typename Narrow, typename Filter>
+    void collideNarrow(const Boxes& _boxes, Narrow& _narrow, Filter& _filter) {
+        ISECT2D_STAT(auto start = std::chrono::steady_clock::now(); auto time = start);
+        clear();
+
+        if (gridFit != GridFit::Manual) {
+            fitGrid(_boxes);
+        }
+        ISECT2D_STAT(stats = Stats(); stats.fitMs = lap(time));
+
+        bin(_boxes);
+        ISECT2D_STAT(stats.binMs = lap(time); countCells(_boxes.size()));
+
+        auto narrow = [&](int32_t _a, int32_t _b) {
+            ISECT2D_STAT(stats.hits++);
+            if (_filter(_a, _b) && _narrow(_a, _b)) {
+                pairs.push_back(Pair{_a, _b});
+            }
+        };
+
+        uint64_t rejected = 0;
+        collideCells(_boxes, 0, split_x * split_y, true, cellBounds, rejected, narrow);
+        ISECT2D_STAT(stats.duplicates += rejected);
+        ISECT2D_STAT(stats.collideMs = lap(time));
+
+        collideOutside(_boxes, narrow);
+        ISECT2D_STAT(stats.outsideMs = lap(time));
+
+        if (gridFit == GridFit::Adaptive) {
+            adapt();
+        }
+
+        unbin();
+        ISECT2D_STAT(stats.pairs = pairs.size();
+                     stats.hits += stats.duplicates;
+                     stats.totalMs = lap(start));
+    }
+
+#ifdef ISECT2D_STATS
+    // Milliseconds elapsed since _since, which is then set to now
+    static double lap(std::chrono::steady_clock::time_point& _since) {
+        auto now = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(now - _since).count();
+        _since = now;
+        return ms;
+    }
+
+    // Fills the occupancy and candidate test counts of the binned boxes
+    void countCells(size_t _boxes) {
+        stats.boxes = _boxes;
+        stats.outsideBoxes = outside.size();
+        stats.cells = split_x * split_y;
+
+        for (i32 c = 0; c < split_x * split_y; c++) {
+            size_t n;
+            cellEntries(c, n);
+
+            size_t bucket = 0;
+            while (bucket < stats.occupancyHistogram.size() - 1 && (size_t(1) << bucket) <= n) {
+                bucket++;
+            }
+            stats.occupancyHistogram[bucket]++;
+
+            stats.cellEntries += n;
+            stats.usedCells += n > 0;
+            stats.maxOccupancy = std::max(stats.maxOccupancy, n);
+            stats.candidateTests += uint64_t(n) * (n - (n > 0)) / 2;
+        }
+
+        if (stats.usedCells > 0) {
+            stats.meanOccupancy = float(stats.cellEntries) / stats.usedCells;
+        }
+
+        uint64_t out = outside.size();
+        stats.candidateTests += out * (out - (out > 0)) / 2 + out * edges.size();
+    }
+#endif
+
+    // Scales the next fitGrid() cells by the error between targetOccupancy
+    // and the mean occupancy of the cells in use, which is higher than the
+    // fitted one when boxes are clustered. Half a step is taken per call.
+    void adapt() {
+        size_t entries = 0;
+        size_t used = 0;
+
+        for (i32 c = 0; c < split_x * split_y; c++) {
+            size_t n;
+            cellEntries(c, n);
+            entries += n;
+            used += n > 0;
+        }
+        if (used == 0) { return; }
+
+        double occupancy = double(entries) / used;
+        double step = std::pow(targetOccupancy / occupancy, 0.25);
+
+        // Cells are already as small as fitGrid() allows
+        if (fitFloored && step < 1) { return; }
+
+        fitScale = clamp(fitScale * step, 1.0 / 16, 16.0);
+    }
+
+
+    // Emits the intersecting pairs of the cells [_begin, _end). With the
+    // owner cell rule, pairs not owned by the current cell are skipped and
+    // counted in _rejected when built with ISECT2D_STATS.
+    template<typename Boxes, typename Emit>
+    void collideCells(const Boxes& _boxes, i32 _begin, i32 _end, bool _owner,
+                      CellBounds& _bounds, uint64_t& _rejected, Emit&& _emit) const {
+        // Counted locally so that the tasks do not share a cache line
+        ISECT2D_STAT(uint64_t rejected = 0);
+        (void)_rejected;
+
+        for (i32 c = _begin; c < _end; c++) {
+            size_t n;
+            const int32_t* v = cellEntries(c, n);
+
+            if (_owner) {
+                i32 cx = c % split_x;
+                i32 cy = c / split_x;
+
+                collideCell(_boxes, v, n, _bounds, [&](int32_t _a, int32_t _b) {
+                    const CellSpan& sa = spans[_a];
+                    const CellSpan& sb = spans[_b];
+
+                    if (ownsPair(sa, sb, cx, cy)) {
+                        _emit(_a, _b);
+                    } else {
+                        ISECT2D_STAT(rejected++);
                     }
+                });
+            } else {
+                collideCell(_boxes, v, n, _bounds, _emit);
+            }
+        }
+
+        ISECT2D_STAT(_rejected += rejected);
+    }
+
+    // Splits the cells in contiguous ranges of about the same number of
+    // candidate tests, one per task. Each task records its hits locally
+    // and the hits are then merged in cell order, through the pairMap
+    // unless the owner cell rule already made them unique, so that pairs
+    // end up in the same order as with a serial run.
+    template<typename Boxes>
+    void collideParallel(const Boxes& _boxes) {
+        i32 cells = split_x * split_y;
+        size_t tasks = std::min(threads, size_t(cells));
+
+        uint64_t total = 0;
+        for (i32 c = 0; c < cells; c++) {
+            size_t n;
+            cellEntries(c, n);
+            total += uint64_t(n) * n;
+        }
+
+        Vector<i32>& bounds = taskBounds;
+        bounds.assign(tasks + 1, cells);
+        bounds[0] = 0;
+
+        uint64_t cost = 0;
+        size_t task = 1;
+        for (i32 c = 0; c < cells && task < tasks; c++) {
+            size_t n;
+            cellEntries(c, n);
+            cost += uint64_t(n) * n;
+
+            if (cost * tasks >= total * task) {
+                bounds[task++] = c + 1;
+            }
+        }
+
+        if (workerPairs.size() < tasks) {
+            workerPairs.resize(tasks);
+            workerBounds.resize(tasks);
+            workerRejected.resize(tasks);
+        }
+
+        auto work = [&](size_t _task) {
+            auto& local = workerPairs[_task];
+            local.clear();
+            workerRejected[_task] = 0;
+
+            collideCells(_boxes, bounds[_task], bounds[_task+1], dedup == Dedup::OwnerCell,
+                         workerBounds[_task], workerRejected[_task],
+                         [&local](int32_t _a, int32_t _b) {
+                local.emplace_back(_a, _b);
+            });
+        };
+
+        if (scheduler) {
+            // A std::function wrapping a reference does not allocate
+            std::function<void(size_t)> run(std::ref(work));
+            scheduler(tasks, run);
+        } else {
+            std::vector<std::thread> workers;
+            for (size_t t = 1; t < tasks; t++) {
+                workers.emplace_back(work, t);
+            }
+            work(0);
+
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+
+        for (size_t t = 0; t < tasks; t++) {
+            ISECT2D_STAT(stats.duplicates += workerRejected[t]);
+
+            for (auto& hit : workerPairs[t]) {
+                if (dedup == Dedup::OwnerCell) {
+                    pairs.push_back(Pair{hit.first, hit.second});
+                } else {
+                    addPair(hit.first, hit.second);
+                }
+            }
+        }
+    }
+
+    /*
+     * Span of _box for the batch intersect(). With a Manual grid it is
+     * clamped into the grid as by cellSpan(). Otherwise boxes entirely
+     * outside of the grid get an empty span and are listed in outside,
+     * those partly outside are listed in edges. A box intersecting one
+     * outside the grid is itself outside or partly outside.
+     */
+    template<typename Box>
+    CellSpan binSpan(const Box& _box, int32_t _index) {
+        if (gridFit == GridFit::Manual) {
+            return cellSpan(_box);
+        }
+
+        i32 x1 = cell(_box.min.x - origin_x, xpad, xshift);
+        i32 y1 = cell(_box.min.y - origin_y, ypad, yshift);
+        i32 x2 = cell(_box.max.x - origin_x, xpad, xshift) + 1;
+        i32 y2 = cell(_box.max.y - origin_y, ypad, yshift) + 1;
+
+        if (x1 >= split_x || y1 >= split_y || x2 <= 0 || y2 <= 0) {
+            outside.push_back(_index);
+            return { 0, 0, 0, 0 };
+        }
+
+        if (x1 < 0 || y1 < 0 || x2 > split_x || y2 > split_y) {
+            edges.push_back(_index);
+        }
+
+        return { std::max(x1, i32(0)), std::max(y1, i32(0)),
+                 std::min(x2, split_x), std::min(y2, split_y) };
+    }
+
+    /*
+     * Emits the pairs of the boxes outside of the grid, which may only
+     * intersect each other and the boxes partly outside. Both sets are
+     * sorted by min x and swept, pairs of two boxes partly outside being
+     * found in the cells.
+     */
+    template<typename Boxes, typename Emit>
+    void collideOutside(const Boxes& _boxes, Emit&& _emit) {
+        if (outside.empty()) { return; }
+
+        sweep.assign(outside.begin(), outside.end());
+        sweep.insert(sweep.end(), edges.begin(), edges.end());
+
+        std::sort(sweep.begin(), sweep.end(), [&](int32_t _a, int32_t _b) {
+            return _boxes[_a].min.x < _boxes[_b].min.x ||
+                   (_boxes[_a].min.x == _boxes[_b].min.x && _a < _b);
+        });
+
+        for (size_t i = 0; i < sweep.size(); i++) {
+            int32_t a = sweep[i];
+            const auto& box = _boxes[a];
+            // Outside boxes have an empty span
+            bool out = spans[a].x1 == spans[a].x2;
+
+            for (size_t j = i + 1; j < sweep.size(); j++) {
+                int32_t b = sweep[j];
+                const auto& other = _boxes[b];
+
+                if (other.min.x > box.max.x) { break; }
+
+                if ((out || spans[b].x1 == spans[b].x2) && overlap(box, other)) {
+                    _emit(std::min(a, b), std::max(a, b));
                 }
             }
         }
+    }
+
+    // Fills the cells of the current storage and the spans with _boxes
+    template<typename Boxes>
+    void bin(const Boxes& _boxes) {
+        if (storage == Storage::Compact) {
+            buildCompact(_boxes);
+            return;
+        }
 
-        if (_insert) {
-            aabbs.push_back(_aabb);
-            int index = aabbs.size() - 1;
+        spans.resize(_boxes.size());
+        outside.clear();
+        edges.clear();
 
-            for (i32 y = y1; y < y2; y++) {
-                for (i32 x = x1; x < x2; x++) {
+        for (size_t index = 0; index < _boxes.size(); index++) {
+            CellSpan s = binSpan(_boxes[index], index);
+            spans[index] = s;
+
+            for (i32 y = s.y1; y < s.y2; y++) {
+                for (i32 x = s.x1; x < s.x2; x++) {
                     gridAABBs[x + y * split_x].push_back(index);
                 }
             }
         }
     }
 
-    void insert(const AABB<V>& _aabb) {
-        i32 x1 = _aabb.min.x / xpad;
-        i32 y1 = _aabb.min.y / ypad;
-        i32 x2 = _aabb.max.x / xpad + 1;
-        i32 y2 = _aabb.max.y / ypad + 1;
+    void unbin() {
+        if (storage == Storage::Buckets) {
+            for (i32 c = 0; c < split_x * split_y; c++) {
+                gridAABBs[c].clear();
+            }
+        }
+    }
 
-        x1 = clamp(x1, i32(0), split_x-1);
-        y1 = clamp(y1, i32(0), split_y-1);
-        x2 = clamp(x2, i32(1), split_x);
-        y2 = clamp(y2, i32(1), split_y);
+    // The buckets are never shrunk, so that they keep their capacity when
+    // the grid is fitted to fewer cells
+    void growCells() {
+        if (gridAABBs.size() < size_t(split_x * split_y)) {
+            gridAABBs.resize(split_x * split_y);
+        }
+    }
 
-        aabbs.push_back(_aabb);
-        int index = aabbs.size() - 1;
+    // Two passes over _boxes: count the entries of each cell, then
+    // scatter the box indices at the prefix sum of the counts. Indices
+    // are stored in increasing order within each cell.
+    template<typename Boxes>
+    void buildCompact(const Boxes& _boxes) {
+        i32 cells = split_x * split_y;
+
+        spans.resize(_boxes.size());
+        cellOffsets.assign(cells + 1, 0);
+        outside.clear();
+        edges.clear();
+
+        for (size_t i = 0; i < _boxes.size(); i++) {
+            CellSpan s = binSpan(_boxes[i], i);
+            spans[i] = s;
 
-        for (i32 y = y1; y < y2; y++) {
-            for (i32 x = x1; x < x2; x++) {
-                gridAABBs[x + y * split_x].push_back(index);
+            for (i32 y = s.y1; y < s.y2; y++) {
+                for (i32 x = s.x1; x < s.x2; x++) {
+                    cellOffsets[x + y * split_x + 1]++;
+                }
+            }
+        }
+
+        for (i32 c = 0; c < cells; c++) {
+            cellOffsets[c+1] += cellOffsets[c];
+        }
+
+        cellIndices.resize(cellOffsets[cells]);
+        cellCursor.assign(cellOffsets.begin(), cellOffsets.end() - 1);
+
+        for (size_t i = 0; i < _boxes.size(); i++) {
+            const CellSpan& s = spans[i];
+
+            for (i32 y = s.y1; y < s.y2; y++) {
+                for (i32 x = s.x1; x < s.x2; x++) {
+                    cellIndices[cellCursor[x + y * split_x]++] = i;
+                }
             }
         }
     }
 
-/*
- * Performs broadphase collision detection on _aabbs dividing the
- * screen size _resolution by _split on X and Y dimension Returns the
- * set of colliding pairs in the _aabbs container
- */
-   void intersect(const std::vector<AABB<V>>& _aabbs) {
+    template<typename T>
+    static constexpr bool exactAsFloat() {
+        return !std::is_integral<T>::value ||
+               std::numeric_limits<T>::digits <= std::numeric_limits<float>::digits;
+    }
 
-      clear();
-
-      size_t index = 0;
-      for (const auto& aabb : _aabbs) {
-          i32 x1 = aabb.min.x / xpad;
-          i32 y1 = aabb.min.y / ypad;
-          i32 x2 = aabb.max.x / xpad + 1;
-          i32 y2 = aabb.max.y / ypad + 1;
-
-          x1 = clamp(x1, i32(0), split_x-1);
-          y1 = clamp(y1, i32(0), split_y-1);
-          x2 = clamp(x2, i32(1), split_x);
-          y2 = clamp(y2, i32(1), split_y);
-
-          for (i32 y = y1; y < y2; y++) {
-              for (i32 x = x1; x < x2; x++) {
-                  gridAABBs[x + y * split_x].push_back(index);
-              }
-          }
-
-          index++;
-      }
-
-      for (auto& v : gridAABBs) {
-          if (v.empty()) { continue; }
-          // check all items against each other
-          for (size_t j = 0; j < v.size()-1; ++j) {
-              const auto& a(_aabbs[v[j]]);
-
-              for (size_t k = j + 1; k < v.size(); ++k) {
-                  const auto& b(_aabbs[v[k]]);
-
-                  if (a.intersect(b)) {
-                      size_t key = hash_key(hash_int(v[j])<<32 | hash_int(v[k]));
-                      key &= (pairMap.size()-1);
-
-                      int i = pairMap[key];
-
-                      while (i != -1) {
-                          if (pairs[i].first == v[j] && pairs[i].second == v[k]) {
-                              // found
-                              break;
-                          }
-                          i = pairs[i].next;
-                      }
-
-                      if (i == -1) {
-                          pairs.push_back(Pair{v[j], v[k], pairMap[key]});
-                          pairMap[key] = pairs.size()-1;
-                      }
-                  }
-              }
-          }
-          v.clear();
-      }
-   }
+    // check all items of a cell against each other
+    template<typename Boxes, typename Emit>
+    void collideCell(const Boxes& _boxes, const int32_t* v, size_t n,
+                     CellBounds& _bounds, Emit&& _emit) const {
+        if (n < 2) { return; }
+
+        using Coord = typename std::decay<decltype(_boxes[v[0]].min.x)>::type;
+
+        if (kernel == Kernel::Batch && exactAsFloat<Coord>()) {
+            _bounds.gather(_boxes, v, n);
+
+            overlapPairs(_bounds, [&](size_t _j, size_t _k) {
+                _emit(v[_j], v[_k]);
+            });
+            return;
+        }
+
+        for (size_t j = 0; j < n-1; ++j) {
+            const auto& a(_boxes[v[j]]);
+
+            for (size_t k = j + 1; k < n; ++k) {
+                const auto& b(_boxes[v[k]]);
+
+                if (overlap(a, b)) {
+                    _emit(v[j], v[k]);
+                }
+            }
+        }
+    }
+
+    size_t bucket(int32_t _a, int32_t _b) const {
+        size_t key = hash_key(hash_int(_a)<<32 | hash_int(_b));
+        return key & (pairMap.size()-1);
+    }
+
+    void addPair(int32_t _a, int32_t _b) {
+        size_t key = bucket(_a, _b);
+
+        int i = pairMap[key];
+        ISECT2D_STAT(size_t chain = 0; stats.hashLookups++);
+
+        while (i != -1) {
+            ISECT2D_STAT(stats.hashProbes++;
+                         stats.maxChain = std::max(stats.maxChain, ++chain));
+            if (pairs[i].first == _a && pairs[i].second == _b) {
+                // found
+                ISECT2D_STAT(stats.duplicates++);
+                return;
+            }
+            i = pairNext[i];
+        }
+
+        if (pairMap[key] == -1) {
+            touchedBuckets.push_back(key);
+        }
+
+        pairs.push_back(Pair{_a, _b});
+        // Pairs added without the pairMap have no chain link
+        pairNext.resize(pairs.size(), -1);
+        pairNext.back() = pairMap[key];
+        pairMap[key] = pairs.size()-1;
+
+        if (pairs.size() > maxLoadFactor * pairMap.size()) {
+            rehash(pairMap.size() * 2);
+        }
+    }
+
+    // Rebuilds the bucket chains of the current pairs with _size buckets,
+    // the order of pairs is left untouched
+    void rehash(size_t _size) {
+        pairMap.assign(_size, -1);
+        pairNext.resize(pairs.size());
+        touchedBuckets.clear();
+
+        for (size_t i = 0; i < pairs.size(); i++) {
+            size_t key = bucket(pairs[i].first, pairs[i].second);
+
+            if (pairMap[key] == -1) {
+                touchedBuckets.push_back(key);
+            }
+            pairNext[i] = pairMap[key];
+            pairMap[key] = i;
+        }
+    }
 
-private:
     // from fontstash
     static uint64_t hash_int(uint32_t a) {
         a += ~(a<<15);
@@ -241,30 +1800,33 @@ private:
 
 /*
  * Performs broadphase collision detection on _aabbs dividing the
- * screen size _resolution by _split on X and Y dimension Returns the
- * set of colliding pairs in the _aabbs container
+ * screen size _resolution by _split on X and Y dimension. Writes the
+ * colliding pairs of the _aabbs container to _pairs, each once, sorted
+ * by first then second box when _sorted is set.
  *
- * NB: Likely to be slower than ISect2D::intersect() !
+ * NB: Likely to be slower than ISect2D::intersect() ! Its cells are
+ * allocated on each call with std::allocator, whatever the capacity of
+ * _pairs: use an ISect2D, with its Alloc and reserve(), for frames that
+ * must not allocate.
  */
 template<typename V>
-static std::unordered_set<std::pair<int, int>> intersect(const std::vector<AABB<V>>& _aabbs,
-                                                         V _split, V _resolution) {
+static void intersect(const std::vector<AABB<V>>& _aabbs, V _split, V _resolution,
+                      std::vector<IndexPair>& _pairs, bool _sorted = false) {
     struct AABBPair {
         const AABB<V>* aabb;
         unsigned int index;
     };
 
-    std::unordered_set<std::pair<int, int>> pairs;
+    _pairs.clear();
     int n = int(_split.x * _split.y);
-    std::vector<AABBPair>* gridAABBs = new std::vector<AABBPair>[n];
+    std::vector<std::vector<AABBPair>> gridAABBs(n);
 
     const short xpad = short(ceilf(_resolution.x / _split.x));
     const short ypad = short(ceilf(_resolution.y / _split.y));
 
-    short x = 0, y = 0;
-
     for (int j = 0; j < _split.y; ++j) {
         for (int i = 0; i < _split.x; ++i) {
+            short x = i * xpad, y = j * ypad;
             AABB<V> cell(x, y, x + xpad, y + ypad);
 
             for (unsigned int index = 0; index < _aabbs.size(); ++index) {
@@ -274,52 +1836,88 @@ static std::unordered_set<std::pair<int, int>> intersect(const std::vector<AABB<
                     gridAABBs[int(i + j * _split.x)].push_back({aabb, index});
                 }
             }
-            x += xpad;
-
-            if (x >= _resolution.x) {
-                x = 0;
-                y += ypad;
-            }
         }
     }
 
-    for (int i = 0; i < n; ++i) {
-        auto& v = gridAABBs[i];
+    for (int j = 0; j < _split.y; ++j) {
+        for (int i = 0; i < _split.x; ++i) {
+            auto& v = gridAABBs[int(i + j * _split.x)];
+            short x = i * xpad, y = j * ypad;
+
+            for (size_t a = 0; a < v.size(); ++a) {
+                for (size_t b = a + 1; b < v.size(); ++b) {
+                    const AABB<V>& aabbA = *v[a].aabb;
+                    const AABB<V>& aabbB = *v[b].aabb;
 
-        for (size_t j = 0; j < v.size(); ++j) {
-            for (size_t k = j + 1; k < v.size(); ++k) {
+                    // Both boxes are also in the cell on the left or above
+                    // when their min corners reach its edge, the pair is
+                    // only reported by the first cell holding both
+                    if ((i > 0 && std::max(aabbA.min.x, aabbB.min.x) <= x) ||
+                        (j > 0 && std::max(aabbA.min.y, aabbB.min.y) <= y)) {
+                        continue;
+                    }
 
-                if (v[j].index != v[k].index && v[j].aabb->intersect(*v[k].aabb)) {
-                    pairs.insert({ v[j].index, v[k].index });
+                    if (aabbA.intersect(aabbB)) {
+                        _pairs.push_back({ v[a].index, v[b].index });
+                    }
                 }
             }
         }
     }
 
-    delete[] gridAABBs;
-    return pairs;
+    if (_sorted) {
+        sortPairs(_pairs);
+    }
 }
 
 /*
- * Performs bruteforce broadphase collision detection on _aabbs
- * Returns the set of colliding pairs in the _aabbs container
+ * Same as above, returning the set of colliding pairs in the _aabbs
+ * container
  */
 template<typename V>
-static std::unordered_set<std::pair<int, int>> intersect(const std::vector<AABB<V>>& _aabbs) {
-    std::unordered_set<std::pair<int, int>> pairs;
+static std::unordered_set<std::pair<int, int>> intersect(const std::vector<AABB<V>>& _aabbs,
+                                                         V _split, V _resolution) {
+    std::vector<IndexPair> found;
+    intersect(_aabbs, _split, _resolution, found);
 
-    if (_aabbs.size() == 0) {
-        return pairs;
+    std::unordered_set<std::pair<int, int>> pairs(found.size());
+    for (auto& pair : found) {
+        pairs.insert({ pair.first, pair.second });
     }
+    return pairs;
+}
+
+/*
+ * Performs bruteforce broadphase collision detection on _aabbs
+ * Writes the colliding pairs of the _aabbs container to _pairs, sorted
+ * by first then second box
+ */
+template<typename V>
+static void intersect(const std::vector<AABB<V>>& _aabbs, std::vector<IndexPair>& _pairs) {
+    _pairs.clear();
 
     for (size_t i = 0; i < _aabbs.size(); ++i) {
         for (size_t j = i + 1; j < _aabbs.size(); ++j) {
             if (_aabbs[i].intersect(_aabbs[j])) {
-                pairs.insert({ i, j });
+                _pairs.push_back({ uint32_t(i), uint32_t(j) });
             }
         }
     }
+}
+
+/*
+ * Same as above, returning the set of colliding pairs in the _aabbs
+ * container
+ */
+template<typename V>
+static std::unordered_set<std::pair<int, int>> intersect(const std::vector<AABB<V>>& _aabbs) {
+    std::vector<IndexPair> found;
+    intersect(_aabbs, found);
 
+    std::unordered_set<std::pair<int, int>> pairs(found.size());
+    for (auto& pair : found) {
+        pairs.insert({ pair.first, pair.second });
+    }
     return pairs;
 }
 
@@ -2,6 +2,8 @@
 
 #include <algorithm>
 #include <array>
+#include <cmath>
+#include <limits>
 #include "vec.h"
 
 namespace isect2d {
@@ -167,4 +169,148 @@ inline static bool intersect(const OBB<V>& _a, const OBB<V>& _b) {
     return axisCollide(_a, _b, _a.getAxes()) && axisCollide(_a, _b, _b.getAxes());
 }
 
+/*
+ * Oriented bounding box stored as centroid, half extents and unit axis
+ * (6 floats instead of the 14 of OBB). The quad is only computed when
+ * asked for, so moving or rotating the box costs no update.
+ */
+template<typename V>
+struct CompactOBB {
+
+    CompactOBB() : m_halfExtents(0, 0), m_axis(1, 0) {}
+
+    CompactOBB(float _cx, float _cy, float _a, float _w, float _h) :
+        m_centroid(_cx, _cy),
+        m_halfExtents(_w / 2, _h / 2) {
+
+        rotate(_a);
+    }
+
+    CompactOBB(V _center, V _normal, float _w, float _h) :
+        m_centroid(_center) {
+
+        // Unlike OBB the axis is kept unit length, its length scales the box
+        float length = std::sqrt(_normal.x * _normal.x + _normal.y * _normal.y);
+
+        m_axis = V(_normal.x / length, _normal.y / length);
+        m_halfExtents = V(_w / 2 * length, _h / 2 * length);
+    }
+
+    explicit CompactOBB(const OBB<V>& _obb) :
+        CompactOBB(_obb.getCentroid(), _obb.getAxes(), _obb.getWidth(), _obb.getHeight()) {}
+
+    void move(const float _px, const float _py) {
+        m_centroid = V(_px, _py);
+    }
+
+    void rotate(float _angle) {
+        m_axis = V(-cos(-_angle), sin(-_angle));
+    }
+
+    float getAngle() const {
+        return -atan2(-m_axis.y, m_axis.x);
+    }
+
+    V getAxes() const {
+        return m_axis;
+    }
+
+    V getCentroid() const {
+        return m_centroid;
+    }
+
+    V getHalfExtents() const {
+        return m_halfExtents;
+    }
+
+    float getWidth() const {
+        return m_halfExtents.x * 2;
+    }
+
+    float getHeight() const {
+        return m_halfExtents.y * 2;
+    }
+
+    float radius() const {
+        V extent(getWidth(), getHeight());
+
+        return extent.length();
+    }
+
+    std::array<V, 4> getQuad() const {
+        V x = m_axis * m_halfExtents.x;
+        V y = V{ -m_axis.y, m_axis.x } * m_halfExtents.y;
+
+        return {{ m_centroid - x - y,   // lower-left
+                  m_centroid + x - y,   // lower-right
+                  m_centroid + x + y,   // uper-right
+                  m_centroid - x + y }}; // uper-left
+    }
+
+    AABB<V> getExtent() const {
+        float ex = std::abs(m_axis.x) * m_halfExtents.x + std::abs(m_axis.y) * m_halfExtents.y;
+        float ey = std::abs(m_axis.y) * m_halfExtents.x + std::abs(m_axis.x) * m_halfExtents.y;
+
+        return { m_centroid.x - ex, m_centroid.y - ey, m_centroid.x + ex, m_centroid.y + ey };
+    }
+
+private:
+
+    V m_centroid;
+    V m_halfExtents;
+    V m_axis;
+
+};
+
+/*
+ * Separating axis test on the axes of both boxes, comparing the distance of
+ * the centroids with the sum of the half extents projected on each axis
+ */
+template<typename V>
+inline static bool intersect(const CompactOBB<V>& _a, const CompactOBB<V>& _b) {
+    V d = _b.getCentroid() - _a.getCentroid();
+    V ua = _a.getAxes();
+    V ub = _b.getAxes();
+    V ha = _a.getHalfExtents();
+    V hb = _b.getHalfExtents();
+
+    // |cos| and |sin| of the angle between both axes
+    float c = std::abs(ua.x * ub.x + ua.y * ub.y);
+    float s = std::abs(ua.x * ub.y - ua.y * ub.x);
+
+    return std::abs(d.x * ua.x + d.y * ua.y) <= ha.x + hb.x * c + hb.y * s &&
+           std::abs(d.y * ua.x - d.x * ua.y) <= ha.y + hb.x * s + hb.y * c &&
+           std::abs(d.x * ub.x + d.y * ub.y) <= hb.x + ha.x * c + ha.y * s &&
+           std::abs(d.y * ub.x - d.x * ub.y) <= hb.y + ha.x * s + ha.y * c;
+}
+
+/*
+ * Distance from _point to the box of centroid _centroid, unit axis _axis
+ * and half extents _half, 0 inside of the box
+ */
+template<typename V>
+inline static float distanceToBox(const V& _point, const V& _centroid, const V& _axis, const V& _half) {
+    V d = _point - _centroid;
+
+    float x = std::max(std::abs(d.x * _axis.x + d.y * _axis.y) - _half.x, 0.f);
+    float y = std::max(std::abs(d.y * _axis.x - d.x * _axis.y) - _half.y, 0.f);
+
+    return std::sqrt(x * x + y * y);
+}
+
+template<typename V>
+inline static float distance(const OBB<V>& _obb, const V& _point) {
+    // The quad of an OBB is scaled by the length of its axes
+    V axis = _obb.getAxes();
+    float length = std::sqrt(axis.x * axis.x + axis.y * axis.y);
+
+    return distanceToBox(_point, _obb.getCentroid(), axis * (1 / length),
+                         V(_obb.getWidth(), _obb.getHeight()) * (length / 2));
+}
+
+template<typename V>
+inline static float distance(const CompactOBB<V>& _obb, const V& _point) {
+    return distanceToBox(_point, _obb.getCentroid(), _obb.getAxes(), _obb.getHalfExtents());
+}
+
 }
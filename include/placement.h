@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "isect2d.h"
+
+namespace isect2d {
+
+/*
+ * Greedy occlusion placement, as used for label collision. Items are placed
+ * by decreasing priority, and an item is accepted when it collides with none
+ * of the items accepted before it. Otherwise the first accepted item found
+ * colliding with it is recorded as its blocker.
+ *
+ * The grid of the accepted items is kept between calls, so that placing the
+ * items of each frame does not allocate once the cells have grown.
+ */
+template<typename V>
+struct Placement {
+
+    static const int32_t none = -1;
+
+    // Indices of the accepted items, in placement order
+    std::vector<int32_t> accepted;
+
+    // Item that blocked each item, none for the accepted ones
+    std::vector<int32_t> blockers;
+
+    void resize(const V _split, const V _resolution) {
+        grid.resize(_split, _resolution);
+    }
+
+    /*
+     * Places the items on their AABBs only. Items of equal priority are
+     * placed in their order in _aabbs, as are all items when _priorities
+     * is empty.
+     */
+    void place(const std::vector<AABB<V>>& _aabbs, const std::vector<float>& _priorities) {
+        begin(_aabbs.size(), _priorities);
+
+        for (int32_t item : order) {
+            tryPlace(_aabbs, item, [](int32_t) { return true; });
+        }
+    }
+
+    /*
+     * Same as above, but an item is only blocked by the items whose AABBs
+     * intersect its own and whose _obbs collide with its own. _obbs may be
+     * OBBs or CompactOBBs.
+     */
+    template<typename O>
+    void place(const std::vector<AABB<V>>& _aabbs, const std::vector<float>& _priorities,
+               const std::vector<O>& _obbs) {
+        begin(_aabbs.size(), _priorities);
+
+        for (int32_t item : order) {
+            const O& obb = _obbs[item];
+
+            tryPlace(_aabbs, item, [&](int32_t _other) {
+                return intersect(obb, _obbs[_other]);
+            });
+        }
+    }
+
+private:
+
+    ISect2D<V> grid{0};
+    std::vector<int32_t> order;
+    // Item of each box of the grid
+    std::vector<int32_t> items;
+
+    void begin(size_t _count, const std::vector<float>& _priorities) {
+        grid.clear();
+        accepted.clear();
+        items.clear();
+        blockers.assign(_count, none);
+
+        order.resize(_count);
+        for (size_t i = 0; i < _count; i++) {
+            order[i] = i;
+        }
+
+        if (!_priorities.empty()) {
+            std::stable_sort(order.begin(), order.end(), [&](int32_t _a, int32_t _b) {
+                return _priorities[_a] > _priorities[_b];
+            });
+        }
+    }
+
+    // Inserts _item unless an accepted item intersecting its AABB passes
+    // _collide, which then becomes its blocker
+    template<typename Collide>
+    void tryPlace(const std::vector<AABB<V>>& _aabbs, int32_t _item, Collide&& _collide) {
+        int32_t blocker = none;
+
+        grid.intersect(_aabbs[_item], [&](const AABB<V>&, const AABB<V>& _other) {
+            int32_t other = items[&_other - grid.aabbs.data()];
+
+            if (_collide(other)) {
+                blocker = other;
+                return false;
+            }
+            return true;
+        });
+
+        if (blocker == none) {
+            accepted.push_back(_item);
+            items.push_back(_item);
+        } else {
+            blockers[_item] = blocker;
+        }
+    }
+};
+
+template<typename V>
+const int32_t Placement<V>::none;
+
+}
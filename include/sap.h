@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "aabb.h"
+
+namespace isect2d {
+
+/*
+ * Sort and sweep broadphase. Boxes are sorted on their min x, then each box
+ * is tested on y against the following ones until their min x goes past its
+ * max x. Unlike the grids it does not depend on the box sizes nor on their
+ * spread over the screen.
+ *
+ * The sorted order is kept between calls and fixed up with an insertion
+ * sort, which is close to linear when boxes only moved slightly since the
+ * previous frame.
+ */
+template<typename V>
+struct SAP {
+    using Value = typename V::value_type;
+
+    // Colliding pairs of the last intersect(), first < second
+    std::vector<std::pair<int32_t, int32_t>> pairs;
+
+    // Shifts allowed per box before falling back to a full sort
+    size_t maxShiftsPerBox = 8;
+
+    void clear() {
+        pairs.clear();
+        sorted.clear();
+    }
+
+    void intersect(const std::vector<AABB<V>>& _aabbs) {
+        pairs.clear();
+
+        sort(_aabbs);
+
+        size_t n = sorted.size();
+
+        for (size_t i = 0; i < n; i++) {
+            const Entry& a = sorted[i];
+
+            for (size_t j = i + 1; j < n && sorted[j].minx <= a.maxx; j++) {
+                const Entry& b = sorted[j];
+
+                if (b.maxy >= a.miny && b.miny <= a.maxy) {
+                    if (a.index < b.index) {
+                        pairs.emplace_back(a.index, b.index);
+                    } else {
+                        pairs.emplace_back(b.index, a.index);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    struct Entry {
+        Value minx, maxx, miny, maxy;
+        int32_t index;
+    };
+
+    std::vector<Entry> sorted;
+
+    static bool less(const Entry& _a, const Entry& _b) {
+        return _a.minx < _b.minx;
+    }
+
+    void sort(const std::vector<AABB<V>>& _aabbs) {
+        size_t n = _aabbs.size();
+
+        if (sorted.size() != n) {
+            sorted.resize(n);
+            for (size_t i = 0; i < n; i++) {
+                sorted[i].index = i;
+            }
+        }
+
+        // Refresh the bounds, keeping the order of the previous call
+        for (auto& e : sorted) {
+            const AABB<V>& aabb = _aabbs[e.index];
+            e.minx = aabb.min.x;
+            e.maxx = aabb.max.x;
+            e.miny = aabb.min.y;
+            e.maxy = aabb.max.y;
+        }
+
+        size_t shifts = 0;
+        size_t maxShifts = maxShiftsPerBox * n;
+
+        for (size_t i = 1; i < n; i++) {
+            Entry e = sorted[i];
+            size_t j = i;
+
+            while (j > 0 && less(e, sorted[j - 1])) {
+                sorted[j] = sorted[j - 1];
+                j--;
+            }
+            sorted[j] = e;
+
+            shifts += i - j;
+            if (shifts > maxShifts) {
+                // Far from sorted, the rest is faster to sort from scratch
+                std::stable_sort(sorted.begin(), sorted.end(), less);
+                break;
+            }
+        }
+    }
+};
+
+}
@@ -0,0 +1,409 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#if defined(__AVX__) || defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "aabb.h"
+#include "obb.h"
+
+namespace isect2d {
+
+#if defined(__AVX__)
+static const size_t simdWidth = 8;
+#else
+static const size_t simdWidth = 4;
+#endif
+
+static inline uint32_t countTrailingZeros(uint32_t _mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, _mask);
+    return index;
+#else
+    return __builtin_ctz(_mask);
+#endif
+}
+
+// Minimal set of lane-wise float operations over simdWidth lanes
+namespace simd {
+
+#if defined(__AVX__)
+using Float = __m256;
+
+inline Float load(const float* _p) { return _mm256_loadu_ps(_p); }
+inline Float add(Float _a, Float _b) { return _mm256_add_ps(_a, _b); }
+inline Float sub(Float _a, Float _b) { return _mm256_sub_ps(_a, _b); }
+inline Float mul(Float _a, Float _b) { return _mm256_mul_ps(_a, _b); }
+inline Float abs(Float _a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), _a); }
+inline Float lessEqual(Float _a, Float _b) { return _mm256_cmp_ps(_a, _b, _CMP_LE_OQ); }
+inline Float both(Float _a, Float _b) { return _mm256_and_ps(_a, _b); }
+inline uint32_t mask(Float _a) { return _mm256_movemask_ps(_a); }
+#elif defined(__SSE__) || defined(_M_X64)
+using Float = __m128;
+
+inline Float load(const float* _p) { return _mm_loadu_ps(_p); }
+inline Float add(Float _a, Float _b) { return _mm_add_ps(_a, _b); }
+inline Float sub(Float _a, Float _b) { return _mm_sub_ps(_a, _b); }
+inline Float mul(Float _a, Float _b) { return _mm_mul_ps(_a, _b); }
+inline Float abs(Float _a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), _a); }
+inline Float lessEqual(Float _a, Float _b) { return _mm_cmple_ps(_a, _b); }
+inline Float both(Float _a, Float _b) { return _mm_and_ps(_a, _b); }
+inline uint32_t mask(Float _a) { return _mm_movemask_ps(_a); }
+#else
+struct Float { float v[simdWidth]; };
+
+template<typename Op>
+inline Float apply(Float _a, Float _b, Op _op) {
+    Float r;
+    for (size_t i = 0; i < simdWidth; i++) { r.v[i] = _op(_a.v[i], _b.v[i]); }
+    return r;
+}
+
+inline Float load(const float* _p) {
+    Float r;
+    for (size_t i = 0; i < simdWidth; i++) { r.v[i] = _p[i]; }
+    return r;
+}
+inline Float add(Float _a, Float _b) { return apply(_a, _b, [](float a, float b) { return a + b; }); }
+inline Float sub(Float _a, Float _b) { return apply(_a, _b, [](float a, float b) { return a - b; }); }
+inline Float mul(Float _a, Float _b) { return apply(_a, _b, [](float a, float b) { return a * b; }); }
+inline Float abs(Float _a) { return apply(_a, _a, [](float a, float) { return std::fabs(a); }); }
+inline Float lessEqual(Float _a, Float _b) { return apply(_a, _b, [](float a, float b) { return float(a <= b); }); }
+inline Float both(Float _a, Float _b) { return apply(_a, _b, [](float a, float b) { return float(a != 0 && b != 0); }); }
+inline uint32_t mask(Float _a) {
+    uint32_t m = 0;
+    for (size_t i = 0; i < simdWidth; i++) { m |= uint32_t(_a.v[i] != 0) << i; }
+    return m;
+}
+#endif
+
+}
+
+/*
+ * Structure of arrays of AABB bounds. The arrays are padded to a multiple
+ * of simdWidth with empty boxes (min = inf, max = -inf) that never overlap
+ * anything, so batches can always be loaded whole. The arrays use the
+ * allocator Alloc.
+ */
+template<typename Alloc = std::allocator<float>>
+struct BasicAABBSoA {
+    std::vector<float, Alloc> minx;
+    std::vector<float, Alloc> miny;
+    std::vector<float, Alloc> maxx;
+    std::vector<float, Alloc> maxy;
+
+    size_t size() const {
+        return count;
+    }
+
+    void clear() {
+        count = 0;
+        minx.clear();
+        miny.clear();
+        maxx.clear();
+        maxy.clear();
+    }
+
+    template<typename V>
+    void push_back(const AABB<V>& _aabb) {
+        minx.resize(count);
+        miny.resize(count);
+        maxx.resize(count);
+        maxy.resize(count);
+
+        minx.push_back(_aabb.min.x);
+        miny.push_back(_aabb.min.y);
+        maxx.push_back(_aabb.max.x);
+        maxy.push_back(_aabb.max.y);
+        count++;
+
+        pad();
+    }
+
+    // Copies the bounds of the _count boxes _aabbs[_indices[i]]
+    template<typename Boxes>
+    void gather(const Boxes& _aabbs, const int32_t* _indices, size_t _count) {
+        count = _count;
+        size_t padded = (_count + simdWidth - 1) / simdWidth * simdWidth;
+
+        minx.resize(padded);
+        miny.resize(padded);
+        maxx.resize(padded);
+        maxy.resize(padded);
+
+        for (size_t i = 0; i < _count; i++) {
+            const auto& aabb = _aabbs[_indices[i]];
+            minx[i] = aabb.min.x;
+            miny[i] = aabb.min.y;
+            maxx[i] = aabb.max.x;
+            maxy[i] = aabb.max.y;
+        }
+
+        pad();
+    }
+
+private:
+    size_t count = 0;
+
+    void pad() {
+        size_t padded = (count + simdWidth - 1) / simdWidth * simdWidth;
+        float inf = std::numeric_limits<float>::infinity();
+
+        minx.resize(padded);
+        miny.resize(padded);
+        maxx.resize(padded);
+        maxy.resize(padded);
+
+        for (size_t i = count; i < padded; i++) {
+            minx[i] = miny[i] = inf;
+            maxx[i] = maxy[i] = -inf;
+        }
+    }
+};
+
+using AABBSoA = BasicAABBSoA<>;
+
+/*
+ * Tests the box (_minx, _miny, _maxx, _maxy) against the simdWidth boxes
+ * of _soa starting at _offset, which must be a multiple of simdWidth.
+ * Bit i of the result is set when box _offset + i overlaps, with the
+ * same inclusive bounds as AABB::intersect().
+ */
+template<typename Alloc>
+static inline uint32_t overlapMask(float _minx, float _miny, float _maxx, float _maxy,
+                                   const BasicAABBSoA<Alloc>& _soa, size_t _offset) {
+#if defined(__AVX__)
+    __m256 m = _mm256_and_ps(
+        _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(&_soa.maxx[_offset]), _mm256_set1_ps(_minx), _CMP_GE_OQ),
+                      _mm256_cmp_ps(_mm256_loadu_ps(&_soa.maxy[_offset]), _mm256_set1_ps(_miny), _CMP_GE_OQ)),
+        _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(&_soa.minx[_offset]), _mm256_set1_ps(_maxx), _CMP_LE_OQ),
+                      _mm256_cmp_ps(_mm256_loadu_ps(&_soa.miny[_offset]), _mm256_set1_ps(_maxy), _CMP_LE_OQ)));
+    return _mm256_movemask_ps(m);
+#elif defined(__SSE__) || defined(_M_X64)
+    __m128 m = _mm_and_ps(
+        _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(&_soa.maxx[_offset]), _mm_set1_ps(_minx)),
+                   _mm_cmpge_ps(_mm_loadu_ps(&_soa.maxy[_offset]), _mm_set1_ps(_miny))),
+        _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(&_soa.minx[_offset]), _mm_set1_ps(_maxx)),
+                   _mm_cmple_ps(_mm_loadu_ps(&_soa.miny[_offset]), _mm_set1_ps(_maxy))));
+    return _mm_movemask_ps(m);
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < simdWidth; i++) {
+        size_t k = _offset + i;
+        bool hit = _soa.maxx[k] >= _minx && _soa.maxy[k] >= _miny &&
+                   _soa.minx[k] <= _maxx && _soa.miny[k] <= _maxy;
+        mask |= uint32_t(hit) << i;
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Calls _emit(i, j) for each overlapping pair i < j of the boxes in _soa,
+ * in increasing order of i then j.
+ */
+template<typename Alloc, typename Emit>
+static inline void overlapPairs(const BasicAABBSoA<Alloc>& _soa, Emit&& _emit) {
+    size_t n = _soa.size();
+
+    for (size_t i = 0; i + 1 < n; i++) {
+        float minx = _soa.minx[i];
+        float miny = _soa.miny[i];
+        float maxx = _soa.maxx[i];
+        float maxy = _soa.maxy[i];
+
+        for (size_t k = (i + 1) / simdWidth * simdWidth; k < n; k += simdWidth) {
+            uint32_t mask = overlapMask(minx, miny, maxx, maxy, _soa, k);
+
+            // Skip the boxes up to i in the first batch
+            if (k <= i) {
+                mask &= ~((2u << (i - k)) - 1);
+            }
+
+            while (mask) {
+                _emit(i, k + countTrailingZeros(mask));
+                mask &= mask - 1;
+            }
+        }
+    }
+}
+
+/*
+ * Structure of arrays of OBBs, as centroid, unit axis and half extents
+ * along the axis (width) and its perpendicular (height)
+ */
+struct OBBSoA {
+    std::vector<float> cx;
+    std::vector<float> cy;
+    std::vector<float> ax;
+    std::vector<float> ay;
+    std::vector<float> hw;
+    std::vector<float> hh;
+
+    size_t size() const {
+        return cx.size();
+    }
+
+    template<typename V>
+    void assign(const std::vector<OBB<V>>& _obbs) {
+        size_t n = _obbs.size();
+
+        cx.resize(n);
+        cy.resize(n);
+        ax.resize(n);
+        ay.resize(n);
+        hw.resize(n);
+        hh.resize(n);
+
+        for (size_t i = 0; i < n; i++) {
+            const OBB<V>& obb = _obbs[i];
+            V axes = obb.getAxes();
+
+            // The quad of an OBB is scaled by the length of its axes
+            float length = std::sqrt(float(axes.x * axes.x + axes.y * axes.y));
+
+            cx[i] = obb.getCentroid().x;
+            cy[i] = obb.getCentroid().y;
+            ax[i] = axes.x / length;
+            ay[i] = axes.y / length;
+            hw[i] = obb.getWidth() * 0.5f * length;
+            hh[i] = obb.getHeight() * 0.5f * length;
+        }
+    }
+
+    template<typename V>
+    void assign(const std::vector<CompactOBB<V>>& _obbs) {
+        size_t n = _obbs.size();
+
+        cx.resize(n);
+        cy.resize(n);
+        ax.resize(n);
+        ay.resize(n);
+        hw.resize(n);
+        hh.resize(n);
+
+        for (size_t i = 0; i < n; i++) {
+            const CompactOBB<V>& obb = _obbs[i];
+
+            cx[i] = obb.getCentroid().x;
+            cy[i] = obb.getCentroid().y;
+            ax[i] = obb.getAxes().x;
+            ay[i] = obb.getAxes().y;
+            hw[i] = obb.getHalfExtents().x;
+            hh[i] = obb.getHalfExtents().y;
+        }
+    }
+};
+
+/*
+ * Batched separating axis test of the OBB pairs [_pairs, _pairs + _count),
+ * simdWidth pairs at a time. _emit(i, hits, n) is called for each group of
+ * n pairs starting at _pairs[i], bit l of hits being set when both OBBs of
+ * _pairs[i + l] intersect.
+ *
+ * Each of the four axes is tested with the projected radius of both boxes
+ * instead of projecting their corners, so results may differ from
+ * intersect(OBB, OBB) for boxes exactly touching, within float precision.
+ */
+template<typename P, typename Emit>
+static inline void intersectGroups(const OBBSoA& _obbs, const P* _pairs, size_t _count, Emit&& _emit) {
+    enum { CXA, CYA, AXA, AYA, HWA, HHA, CXB, CYB, AXB, AYB, HWB, HHB, LANES };
+
+    float lanes[LANES][simdWidth];
+
+    for (size_t i = 0; i < _count; i += simdWidth) {
+        size_t n = std::min(simdWidth, _count - i);
+
+        for (size_t l = 0; l < simdWidth; l++) {
+            size_t a = l < n ? _pairs[i + l].first : 0;
+            size_t b = l < n ? _pairs[i + l].second : 0;
+
+            lanes[CXA][l] = _obbs.cx[a];
+            lanes[CYA][l] = _obbs.cy[a];
+            lanes[AXA][l] = _obbs.ax[a];
+            lanes[AYA][l] = _obbs.ay[a];
+            lanes[HWA][l] = _obbs.hw[a];
+            lanes[HHA][l] = _obbs.hh[a];
+            lanes[CXB][l] = _obbs.cx[b];
+            lanes[CYB][l] = _obbs.cy[b];
+            lanes[AXB][l] = _obbs.ax[b];
+            lanes[AYB][l] = _obbs.ay[b];
+            lanes[HWB][l] = _obbs.hw[b];
+            lanes[HHB][l] = _obbs.hh[b];
+        }
+
+        using namespace simd;
+
+        Float axa = load(lanes[AXA]), aya = load(lanes[AYA]);
+        Float axb = load(lanes[AXB]), ayb = load(lanes[AYB]);
+        Float hwa = load(lanes[HWA]), hha = load(lanes[HHA]);
+        Float hwb = load(lanes[HWB]), hhb = load(lanes[HHB]);
+
+        Float dx = sub(load(lanes[CXB]), load(lanes[CXA]));
+        Float dy = sub(load(lanes[CYB]), load(lanes[CYA]));
+
+        // |cos| and |sin| of the angle between both axes
+        Float c = abs(add(mul(axa, axb), mul(aya, ayb)));
+        Float s = abs(sub(mul(axa, ayb), mul(aya, axb)));
+
+        // Distance of the centroids against the sum of the projected radii
+        Float onAxisA = lessEqual(abs(add(mul(dx, axa), mul(dy, aya))),
+                                  add(hwa, add(mul(hwb, c), mul(hhb, s))));
+        Float onPerpA = lessEqual(abs(sub(mul(dy, axa), mul(dx, aya))),
+                                  add(hha, add(mul(hwb, s), mul(hhb, c))));
+        Float onAxisB = lessEqual(abs(add(mul(dx, axb), mul(dy, ayb))),
+                                  add(hwb, add(mul(hwa, c), mul(hha, s))));
+        Float onPerpB = lessEqual(abs(sub(mul(dy, axb), mul(dx, ayb))),
+                                  add(hhb, add(mul(hwa, s), mul(hha, c))));
+
+        uint32_t hits = mask(both(both(onAxisA, onPerpA), both(onAxisB, onPerpB)));
+
+        _emit(i, hits, n);
+    }
+}
+
+// _hits[i] is set to 1 when both OBBs of _pairs[i] intersect, 0 otherwise
+template<typename P>
+static inline void intersect(const OBBSoA& _obbs, const P* _pairs, size_t _count, uint8_t* _hits) {
+    intersectGroups(_obbs, _pairs, _count, [&](size_t _i, uint32_t _group, size_t _n) {
+        for (size_t l = 0; l < _n; l++) {
+            _hits[_i + l] = (_group >> l) & 1;
+        }
+    });
+}
+
+// Bit i % 64 of _mask[i / 64] is set when both OBBs of _pairs[i] intersect.
+// The (_count + 63) / 64 words of _mask are overwritten.
+template<typename P>
+static inline void intersect(const OBBSoA& _obbs, const P* _pairs, size_t _count, uint64_t* _mask) {
+    std::fill(_mask, _mask + (_count + 63) / 64, uint64_t(0));
+
+    // simdWidth divides 64, so that a group never straddles two words
+    intersectGroups(_obbs, _pairs, _count, [&](size_t _i, uint32_t _group, size_t _n) {
+        uint64_t bits = _group & ((uint64_t(1) << _n) - 1);
+        _mask[_i / 64] |= bits << (_i % 64);
+    });
+}
+
+template<typename Pairs>
+static inline void intersect(const OBBSoA& _obbs, const Pairs& _pairs, std::vector<uint8_t>& _hits) {
+    _hits.resize(_pairs.size());
+    intersect(_obbs, _pairs.data(), _pairs.size(), _hits.data());
+}
+
+// Same as above, with the hits packed in 64 bit words
+template<typename Pairs>
+static inline void intersect(const OBBSoA& _obbs, const Pairs& _pairs, std::vector<uint64_t>& _mask) {
+    _mask.resize((_pairs.size() + 63) / 64);
+    intersect(_obbs, _pairs.data(), _pairs.size(), _mask.data());
+}
+
+}
@@ -1,11 +1,14 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include "vec.h"
 
 namespace isect2d {
 
 struct Vec2 {
+    using value_type = float;
+
     float x, y;
 
     Vec2(const Vec2& other) {
@@ -59,6 +62,41 @@ inline bool operator!=(const Vec2& lh, const Vec2& rh) {
     return !(lh == rh);
 }
 
+/*
+ * Integer coordinates, such as screen pixels. AABB<Vec2s> only takes half the
+ * size of AABB<Vec2> for its corners, and the ISect2D cells of boxes are found
+ * with shifts when the cell size is a power of two.
+ */
+template<typename T>
+struct IVec2 {
+    using value_type = T;
+
+    T x, y;
+
+    IVec2(T _x = 0, T _y = 0) : x(_x), y(_y) {}
+
+    IVec2 operator+(const IVec2& _b) const {
+        return IVec2(x + _b.x, y + _b.y);
+    }
+
+    IVec2 operator-(const IVec2& _b) const {
+        return IVec2(x - _b.x, y - _b.y);
+    }
+};
+
+template<typename T>
+inline bool operator==(const IVec2<T>& lh, const IVec2<T>& rh) {
+    return lh.x == rh.x && lh.y == rh.y;
+}
+
+template<typename T>
+inline bool operator!=(const IVec2<T>& lh, const IVec2<T>& rh) {
+    return !(lh == rh);
+}
+
+using Vec2i = IVec2<int32_t>;
+using Vec2s = IVec2<int16_t>;
+
 template<>
 inline float dot(const Vec2& _v, const Vec2& _b) {
   return _v.x * _b.x + _v.y * _b.y;
@@ -0,0 +1,593 @@
+#include "isect2d.h"
+#include "aabbtree.h"
+#include "hashgrid.h"
+#include "hgrid.h"
+#include "placement.h"
+#include "sap.h"
+#include "vec2.h"
+#include "scenes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Headless benchmark for the broad and narrow phases.
+ *
+ * Every (scene, n, split) combination is timed for each engine over a
+ * number of iterations and reported as one CSV row on stdout, with the
+ * pair count so that engines can be cross-checked against each other.
+ *
+ *   isect2d_bench.out --scene area,circles --n 1000,10000 --split auto
+ */
+
+using Vec2 = isect2d::Vec2;
+using OBB = isect2d::OBB<Vec2>;
+using AABB = isect2d::AABB<Vec2>;
+
+struct Config {
+    std::vector<std::string> scenes = { "area", "circles" };
+    std::vector<int> counts = { 1000, 10000, 100000 };
+    std::vector<int> splits = { 0 }; // 0: scaled with the scene
+    std::string sizes = "fixed";
+    std::string spread = "auto";
+    std::vector<float> scales = { 1.f };
+    int iters = 15;
+    int warmup = 2;
+    int bruteMax = 20000;
+    int gridMax = 100000;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    float width = 800;
+    float height = 600;
+};
+
+struct Stats {
+    double min, median, p90, p99, max, mean;
+};
+
+static Stats summarize(std::vector<double> _samples) {
+    std::sort(_samples.begin(), _samples.end());
+    size_t n = _samples.size();
+
+    auto percentile = [&](double p) {
+        size_t i = size_t(std::ceil(p * n)) - 1;
+        return _samples[std::min(i, n - 1)];
+    };
+
+    double sum = 0;
+    for (double s : _samples) { sum += s; }
+
+    return { _samples.front(), percentile(0.5), percentile(0.9),
+             percentile(0.99), _samples.back(), sum / n };
+}
+
+template<typename T>
+static std::vector<T> parseList(const char* _arg, std::function<T(const std::string&)> _parse) {
+    std::vector<T> values;
+    std::stringstream ss(_arg);
+    std::string item;
+
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) { values.push_back(_parse(item)); }
+    }
+    return values;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: isect2d_bench.out [options]\n"
+            "  --scene LIST     area,circles,ring (default area,circles)\n"
+            "  --n LIST         box counts (default 1000,10000,100000)\n"
+            "  --split LIST     grid splits per axis, 'auto' scales 16 with the scene\n"
+            "  --sizes DIST     box size multiplier: fixed, uniform or lognormal\n"
+            "  --scale LIST     box size factors applied on top of --sizes\n"
+            "  --spread S       'auto' keeps the scene density of the demo, or a factor\n"
+            "  --iters K        timed iterations per engine (default 15)\n"
+            "  --warmup K       untimed iterations per engine (default 2)\n"
+            "  --brute-max N    largest n run through the bruteforce broadphase\n"
+            "  --grid-max N     largest n run through the naive grid broadphase\n"
+            "  --threads K      workers of the multithreaded ISect2D (default: cores)\n");
+}
+
+static bool parseArgs(int argc, char** argv, Config& _config) {
+    auto toInt = [](const std::string& s) { return s == "auto" ? 0 : atoi(s.c_str()); };
+    auto toFloat = [](const std::string& s) { return float(atof(s.c_str())); };
+    auto toString = [](const std::string& s) { return s; };
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (!strcmp(arg, "--help") || !strcmp(arg, "-h") || !value) {
+            return false;
+        }
+
+        if (!strcmp(arg, "--scene")) {
+            _config.scenes = parseList<std::string>(value, toString);
+        } else if (!strcmp(arg, "--n")) {
+            _config.counts = parseList<int>(value, toInt);
+        } else if (!strcmp(arg, "--split")) {
+            _config.splits = parseList<int>(value, toInt);
+        } else if (!strcmp(arg, "--sizes")) {
+            _config.sizes = value;
+        } else if (!strcmp(arg, "--scale")) {
+            _config.scales = parseList<float>(value, toFloat);
+        } else if (!strcmp(arg, "--spread")) {
+            _config.spread = value;
+        } else if (!strcmp(arg, "--iters")) {
+            _config.iters = std::max(1, atoi(value));
+        } else if (!strcmp(arg, "--warmup")) {
+            _config.warmup = std::max(0, atoi(value));
+        } else if (!strcmp(arg, "--brute-max")) {
+            _config.bruteMax = atoi(value);
+        } else if (!strcmp(arg, "--grid-max")) {
+            _config.gridMax = atoi(value);
+        } else if (!strcmp(arg, "--threads")) {
+            _config.threads = std::max(1, atoi(value));
+        } else {
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
+
+// Box count the scene was designed for in the demo
+static int nativeCount(const std::string& _scene) {
+    return _scene == "ring" ? 10 : 2000;
+}
+
+static bool makeScene(const std::string& _scene, int _n, const Config& _config,
+                      float _spread, float _scale, std::vector<OBB>& _obbs) {
+    srand(0);
+
+    if (_scene == "area") {
+        _obbs = scenes::area<Vec2>(_n, _config.width, _config.height);
+    } else if (_scene == "circles") {
+        _obbs = scenes::circles<Vec2>(_n, _config.width, _config.height);
+    } else if (_scene == "ring") {
+        _obbs = scenes::ring<Vec2>(_n, _config.width, _config.height);
+    } else {
+        return false;
+    }
+
+    std::default_random_engine generator(42);
+    std::uniform_real_distribution<float> uniform(0.5f, 2.f);
+    std::lognormal_distribution<float> lognormal(0.f, 0.75f);
+
+    // Spread the layout around the screen center and rescale each box
+    Vec2 center(_config.width / 2, _config.height / 2);
+
+    for (auto& obb : _obbs) {
+        float factor = _scale;
+        if (_config.sizes == "uniform") {
+            factor *= uniform(generator);
+        } else if (_config.sizes == "lognormal") {
+            factor *= std::min(lognormal(generator), 16.f);
+        }
+
+        Vec2 c = (obb.getCentroid() - center) * _spread + center * _spread;
+        obb = OBB(c, obb.getAxes(), obb.getWidth() * factor, obb.getHeight() * factor);
+    }
+
+    return true;
+}
+
+struct Engine {
+    const char* name;
+    std::function<size_t()> run;
+    // Prints details of the last run to stderr, when set
+    std::function<void()> report;
+};
+
+static void runEngine(const Engine& _engine, const Config& _config, const char* _prefix) {
+    std::vector<double> samples;
+    size_t pairs = 0;
+
+    for (int i = 0; i < _config.warmup; ++i) {
+        pairs = _engine.run();
+    }
+
+    for (int i = 0; i < _config.iters; ++i) {
+        auto begin = std::chrono::steady_clock::now();
+        pairs = _engine.run();
+        auto end = std::chrono::steady_clock::now();
+        samples.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+    }
+
+    Stats stats = summarize(samples);
+
+    printf("%s,%s,%d,%zu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n", _prefix, _engine.name,
+           _config.iters, pairs, stats.min, stats.median, stats.p90, stats.p99,
+           stats.max, stats.mean);
+    fflush(stdout);
+}
+
+static void benchSplit(const Config& _config, const char* _prefix, const std::vector<OBB>& _obbs,
+                       const std::vector<AABB>& _aabbs, int _split, Vec2 _resolution) {
+    using ISect2D = isect2d::ISect2D<Vec2>;
+
+    int n = _aabbs.size();
+    std::vector<Engine> engines;
+    std::vector<isect2d::IndexPair> found;
+
+    if (n <= _config.bruteMax) {
+        engines.push_back({ "bruteforce", [&]() {
+            return isect2d::intersect(_aabbs).size();
+        }});
+    }
+
+    if (n <= _config.gridMax) {
+        engines.push_back({ "grid", [&]() {
+            return isect2d::intersect(_aabbs, Vec2(_split, _split), _resolution).size();
+        }});
+
+        engines.push_back({ "grid-packed", [&, found]() mutable {
+            isect2d::intersect(_aabbs, Vec2(_split, _split), _resolution, found);
+            return found.size();
+        }});
+    }
+
+    std::deque<ISect2D> contexts;
+
+    auto addISect2D = [&](const char* _name, std::function<void(ISect2D&)> _setup) {
+        contexts.emplace_back();
+        ISect2D& context = contexts.back();
+        context.resize(Vec2(_split, _split), _resolution);
+        _setup(context);
+
+        engines.push_back({ _name, [&]() {
+            context.clear();
+            context.intersect(_aabbs);
+            return context.pairs.size();
+        }});
+
+#ifdef ISECT2D_STATS
+        engines.back().report = [&context, _name, _prefix]() {
+            const isect2d::Stats& s = context.stats;
+            fprintf(stderr, "%s,%s,entries=%zu,outside=%zu,used=%zu/%zu,max=%zu,mean=%.2f,"
+                    "tests=%llu,hits=%llu,duplicates=%llu,probes=%llu,chain=%zu,"
+                    "bin_ms=%.4f,collide_ms=%.4f,outside_ms=%.4f\n",
+                    _prefix, _name, s.cellEntries, s.outsideBoxes, s.usedCells, s.cells,
+                    s.maxOccupancy, s.meanOccupancy, (unsigned long long)s.candidateTests,
+                    (unsigned long long)s.hits, (unsigned long long)s.duplicates,
+                    (unsigned long long)s.hashProbes, s.maxChain, s.binMs, s.collideMs,
+                    s.outsideMs);
+        };
+#endif
+    };
+
+    addISect2D("isect2d", [](ISect2D&) {});
+
+    addISect2D("isect2d-compact", [](ISect2D& _context) {
+        _context.storage = ISect2D::Storage::Compact;
+    });
+
+    addISect2D("isect2d-owner", [](ISect2D& _context) {
+        _context.storage = ISect2D::Storage::Compact;
+        _context.dedup = ISect2D::Dedup::OwnerCell;
+    });
+
+    addISect2D("isect2d-batch", [](ISect2D& _context) {
+        _context.storage = ISect2D::Storage::Compact;
+        _context.dedup = ISect2D::Dedup::OwnerCell;
+        _context.kernel = ISect2D::Kernel::Batch;
+    });
+
+    addISect2D("isect2d-fit", [](ISect2D& _context) {
+        _context.storage = ISect2D::Storage::Compact;
+        _context.dedup = ISect2D::Dedup::OwnerCell;
+        _context.kernel = ISect2D::Kernel::Batch;
+        _context.gridFit = ISect2D::GridFit::Adaptive;
+    });
+
+    addISect2D("isect2d-mt", [&](ISect2D& _context) {
+        _context.storage = ISect2D::Storage::Compact;
+        _context.dedup = ISect2D::Dedup::OwnerCell;
+        _context.threads = _config.threads;
+    });
+
+    // Two frames in which a tenth of the boxes move by a quarter pixel and
+    // back, updating only those boxes and their pairs
+    contexts.emplace_back();
+    ISect2D& coherent = contexts.back();
+    coherent.resize(Vec2(_split, _split), _resolution);
+    coherent.updateFrame(_aabbs);
+
+    std::vector<AABB> moved(_aabbs);
+
+    engines.push_back({ "isect2d-coherent", [&]() {
+        for (size_t i = 0; i < moved.size(); i += 10) {
+            moved[i].min.x += 0.25f;
+            moved[i].max.x += 0.25f;
+        }
+        coherent.updateFrame(moved);
+
+        for (size_t i = 0; i < moved.size(); i += 10) {
+            moved[i] = _aabbs[i];
+        }
+        coherent.updateFrame(moved);
+
+        return coherent.addedPairs.size() + coherent.persistingPairs.size();
+    }});
+
+    // Same boxes read in place from packed min/max records, without the
+    // user data pointer of AABB
+    struct Bounds { Vec2 min, max; };
+    std::vector<Bounds> packed;
+    for (auto& aabb : _aabbs) {
+        packed.push_back({ aabb.min, aabb.max });
+    }
+    auto packedView = isect2d::boxView(packed, [](const Bounds& _b) -> const Bounds& {
+        return _b;
+    });
+
+    ISect2D viewContext;
+    viewContext.resize(Vec2(_split, _split), _resolution);
+    viewContext.storage = ISect2D::Storage::Compact;
+    viewContext.dedup = ISect2D::Dedup::OwnerCell;
+
+    engines.push_back({ "isect2d-view", [&]() {
+        viewContext.intersect(packedView);
+        return viewContext.pairs.size();
+    }});
+
+    // Same boxes snapped to integer pixels
+    using ISect2Di = isect2d::ISect2D<isect2d::Vec2i>;
+    std::vector<isect2d::AABB<isect2d::Vec2i>> pixelAABBs;
+    for (auto& aabb : _aabbs) {
+        pixelAABBs.emplace_back(std::floor(aabb.min.x), std::floor(aabb.min.y),
+                                std::ceil(aabb.max.x), std::ceil(aabb.max.y));
+    }
+
+    ISect2Di pixelContext;
+    pixelContext.resize(isect2d::Vec2i(_split, _split),
+                        isect2d::Vec2i(_resolution.x, _resolution.y));
+    pixelContext.storage = ISect2Di::Storage::Compact;
+    pixelContext.dedup = ISect2Di::Dedup::OwnerCell;
+
+    engines.push_back({ "isect2d-int", [&]() {
+        pixelContext.intersect(pixelAABBs);
+        return pixelContext.pairs.size();
+    }});
+
+    // Greedy placement through the single box query, keeping the boxes
+    // colliding with none of the boxes placed before them
+    ISect2D placement;
+    placement.resize(Vec2(_split, _split), _resolution);
+
+    auto reject = [](const isect2d::AABB<Vec2>&, const isect2d::AABB<Vec2>&) {
+        return false;
+    };
+
+    engines.push_back({ "query-function", [&]() {
+        placement.clear();
+        std::function<bool(const isect2d::AABB<Vec2>&, const isect2d::AABB<Vec2>&)> cb = reject;
+        for (auto& aabb : _aabbs) {
+            placement.intersect(aabb, cb);
+        }
+        return placement.aabbs.size();
+    }});
+
+    engines.push_back({ "query-template", [&]() {
+        placement.clear();
+        for (auto& aabb : _aabbs) {
+            placement.intersect(aabb, reject);
+        }
+        return placement.aabbs.size();
+    }});
+
+    // Point, rectangle and segment queries over the boxes inserted once,
+    // from the centroids of a thousand boxes to the next one
+    isect2d::ISect2D<Vec2> populated;
+    populated.resize(Vec2(_split, _split), _resolution);
+    for (auto& aabb : _aabbs) {
+        populated.insert(aabb);
+    }
+
+    engines.push_back({ "query-region", [&]() {
+        size_t hits = 0;
+        auto count = [&](int32_t) { hits++; return true; };
+        size_t step = std::max(_aabbs.size() / 1000, size_t(1));
+
+        for (size_t i = 0; i + step < _aabbs.size(); i += step) {
+            Vec2 a = _aabbs[i].getCentroid();
+            Vec2 b = _aabbs[i + step].getCentroid();
+
+            populated.queryPoint(a, count);
+            populated.queryRect(AABB(std::min(a.x, b.x), std::min(a.y, b.y),
+                                     std::max(a.x, b.x), std::max(a.y, b.y)), count);
+            populated.querySegment(a, b, count);
+        }
+        return hits;
+    }});
+
+    std::vector<isect2d::ISect2D<Vec2>::Neighbor> neighbors;
+
+    engines.push_back({ "query-nearest", [&]() {
+        size_t found = 0;
+        size_t step = std::max(_aabbs.size() / 1000, size_t(1));
+
+        for (size_t i = 0; i < _aabbs.size(); i += step) {
+            populated.nearest(_aabbs[i].getCentroid(), 8, neighbors);
+            found += neighbors.size();
+        }
+        return found;
+    }});
+
+    isect2d::Placement<Vec2> occlusion;
+    occlusion.resize(Vec2(_split, _split), _resolution);
+    std::vector<float> priorities;
+
+    engines.push_back({ "placement", [&]() {
+        occlusion.place(_aabbs, priorities);
+        return occlusion.accepted.size();
+    }});
+
+    engines.push_back({ "placement-obb", [&]() {
+        occlusion.place(_aabbs, priorities, _obbs);
+        return occlusion.accepted.size();
+    }});
+
+    isect2d::SAP<Vec2> sap;
+
+    engines.push_back({ "sap", [&]() {
+        sap.intersect(_aabbs);
+        return sap.pairs.size();
+    }});
+
+    isect2d::AABBTree<Vec2> tree;
+    std::vector<int32_t> proxies;
+    for (auto& aabb : _aabbs) {
+        proxies.push_back(tree.insert(aabb));
+    }
+
+    engines.push_back({ "aabbtree", [&]() {
+        for (size_t i = 0; i < _aabbs.size(); i++) {
+            tree.update(proxies[i], _aabbs[i]);
+        }
+        tree.intersect();
+        return tree.pairs.size();
+    }});
+
+    isect2d::HGrid<Vec2> hgrid;
+    hgrid.resize(_resolution, _resolution.x / _split);
+
+    engines.push_back({ "hgrid", [&]() {
+        hgrid.intersect(_aabbs);
+        return hgrid.pairs.size();
+    }});
+
+    isect2d::HashGrid<Vec2> hashGrid(Vec2(_resolution.x / _split, _resolution.y / _split));
+
+    engines.push_back({ "hashgrid", [&]() {
+        hashGrid.intersect(_aabbs);
+        return hashGrid.pairs.size();
+    }});
+
+    // Narrow phase over the pairs of the first ISect2D run
+    const ISect2D& context = contexts.front();
+
+    engines.push_back({ "narrowphase", [&]() {
+        size_t collisions = 0;
+        for (auto& pair : context.pairs) {
+            if (intersect(_obbs[pair.first], _obbs[pair.second])) {
+                collisions++;
+            }
+        }
+        return collisions;
+    }});
+
+    std::vector<isect2d::CompactOBB<Vec2>> compactOBBs(_obbs.begin(), _obbs.end());
+
+    engines.push_back({ "narrowphase-compact", [&]() {
+        size_t collisions = 0;
+        for (auto& pair : context.pairs) {
+            if (intersect(compactOBBs[pair.first], compactOBBs[pair.second])) {
+                collisions++;
+            }
+        }
+        return collisions;
+    }});
+
+    // Broadphase and compact narrow phase in one pass
+    ISect2D fused;
+    fused.resize(Vec2(_split, _split), _resolution);
+    fused.storage = ISect2D::Storage::Compact;
+    fused.kernel = ISect2D::Kernel::Batch;
+
+    engines.push_back({ "isect2d-fused", [&]() {
+        fused.intersect(_aabbs, [&](int32_t _a, int32_t _b) {
+            return intersect(compactOBBs[_a], compactOBBs[_b]);
+        });
+        return fused.pairs.size();
+    }});
+
+    isect2d::OBBSoA obbSoA;
+    std::vector<uint8_t> hits;
+
+    engines.push_back({ "narrowphase-batch", [&]() {
+        obbSoA.assign(_obbs);
+        isect2d::intersect(obbSoA, context.pairs, hits);
+        return size_t(std::count(hits.begin(), hits.end(), 1));
+    }});
+
+    std::vector<uint64_t> mask;
+
+    engines.push_back({ "narrowphase-mask", [&]() {
+        obbSoA.assign(_obbs);
+        isect2d::intersect(obbSoA, context.pairs, mask);
+
+        size_t count = 0;
+        for (uint64_t word : mask) {
+            count += __builtin_popcountll(word);
+        }
+        return count;
+    }});
+
+    for (auto& engine : engines) {
+        runEngine(engine, _config, _prefix);
+
+        if (engine.report) {
+            engine.report();
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    Config config;
+
+    if (!parseArgs(argc, argv, config)) {
+        usage();
+        return 1;
+    }
+
+    printf("scene,n,split,sizes,scale,engine,iters,pairs,"
+           "min_ms,median_ms,p90_ms,p99_ms,max_ms,mean_ms\n");
+
+    for (const auto& scene : config.scenes) {
+        for (int n : config.counts) {
+            for (float scale : config.scales) {
+                float spread = config.spread == "auto"
+                    ? std::max(1.f, std::sqrt(float(n) / nativeCount(scene)))
+                    : float(atof(config.spread.c_str()));
+
+                std::vector<OBB> obbs;
+                if (!makeScene(scene, n, config, spread, scale, obbs)) {
+                    fprintf(stderr, "unknown scene '%s'\n", scene.c_str());
+                    return 1;
+                }
+
+                Vec2 resolution(config.width * spread, config.height * spread);
+
+                std::vector<AABB> aabbs;
+                aabbs.reserve(obbs.size());
+                for (auto& obb : obbs) {
+                    aabbs.push_back(obb.getExtent());
+                }
+
+                for (int s : config.splits) {
+                    int split = s > 0 ? s : std::max(1, int(std::lround(16 * spread)));
+
+                    char prefix[256];
+                    snprintf(prefix, sizeof(prefix), "%s,%d,%d,%s,%g", scene.c_str(), n,
+                             split, config.sizes.c_str(), scale);
+
+                    benchSplit(config, prefix, obbs, aabbs, split, resolution);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,1029 @@
+#include "isect2d.h"
+#include "aabbtree.h"
+#include "allocator.h"
+#include "boxview.h"
+#include "hashgrid.h"
+#include "hgrid.h"
+#include "placement.h"
+#include "sap.h"
+#include "soa.h"
+#include "vec2.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+/*
+ * Cross-checks the broadphases, the narrow-phases, the handle and frame
+ * APIs, the queries and the placement against brute force on random
+ * scenes, and that warmed-up frames do not allocate. Prints each mismatch
+ * and exits with 1 when there is any.
+ *
+ *   isect2d_check.out
+ */
+
+using Vec2 = isect2d::Vec2;
+using OBB = isect2d::OBB<Vec2>;
+using CompactOBB = isect2d::CompactOBB<Vec2>;
+using AABB = isect2d::AABB<Vec2>;
+using ISect2D = isect2d::ISect2D<Vec2>;
+using Pairs = std::vector<std::pair<int32_t, int32_t>>;
+
+static int failures = 0;
+
+static void check(bool _ok, const char* _what, int _round) {
+    if (!_ok) {
+        failures++;
+        std::printf("FAIL %s (round %d)\n", _what, _round);
+    }
+}
+
+template<typename Range>
+static Pairs sorted(const Range& _pairs) {
+    Pairs result;
+    for (auto& pair : _pairs) {
+        result.emplace_back(pair.first, pair.second);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+// Pairs of the boxes with _alive set, all of them when _alive is empty
+template<typename Box>
+static Pairs brute(const std::vector<Box>& _aabbs, const std::vector<bool>& _alive = {}) {
+    Pairs pairs;
+    for (size_t i = 0; i < _aabbs.size(); i++) {
+        if (!_alive.empty() && !_alive[i]) { continue; }
+
+        for (size_t j = i + 1; j < _aabbs.size(); j++) {
+            if (!_alive.empty() && !_alive[j]) { continue; }
+
+            if (_aabbs[i].intersect(_aabbs[j])) {
+                pairs.emplace_back(i, j);
+            }
+        }
+    }
+    return pairs;
+}
+
+static Pairs difference(const Pairs& _a, const Pairs& _b) {
+    Pairs result;
+    std::set_difference(_a.begin(), _a.end(), _b.begin(), _b.end(), std::back_inserter(result));
+    return result;
+}
+
+static Pairs common(const Pairs& _a, const Pairs& _b) {
+    Pairs result;
+    std::set_intersection(_a.begin(), _a.end(), _b.begin(), _b.end(), std::back_inserter(result));
+    return result;
+}
+
+static AABB randomBox(std::mt19937& _rng, float _min, float _max, float _size) {
+    std::uniform_real_distribution<float> position(_min, _max);
+    std::uniform_real_distribution<float> extent(0, _size);
+
+    float x = position(_rng);
+    float y = position(_rng);
+    return AABB(x, y, x + extent(_rng), y + extent(_rng));
+}
+
+static std::vector<AABB> randomBoxes(std::mt19937& _rng, int _n, float _min, float _max, float _size) {
+    std::vector<AABB> aabbs;
+    for (int i = 0; i < _n; i++) {
+        aabbs.push_back(randomBox(_rng, _min, _max, _size));
+    }
+    return aabbs;
+}
+
+// OBB drawn from its centroid, axis of any length and extents
+struct Shape {
+    Vec2 center, normal;
+    float w, h;
+
+    OBB scaled(float _scale) const {
+        return OBB(center, normal, w * _scale, h * _scale);
+    }
+};
+
+static std::vector<Shape> randomShapes(std::mt19937& _rng, int _n, float _min, float _max, float _size) {
+    std::uniform_real_distribution<float> position(_min, _max);
+    std::uniform_real_distribution<float> unit(0, 1);
+
+    std::vector<Shape> shapes;
+    for (int i = 0; i < _n; i++) {
+        float a = unit(_rng) * 6.3f;
+        float length = i % 4 == 0 ? 0.5f + unit(_rng) * 3 : 1;
+        Vec2 center(position(_rng), position(_rng));
+        Vec2 normal(std::cos(a) * length, std::sin(a) * length);
+        shapes.push_back({ center, normal, 1 + unit(_rng) * _size, 1 + unit(_rng) * _size });
+    }
+    return shapes;
+}
+
+// intersect(OBB, OBB) of both shapes, -1 when growing or shrinking them
+// by a tolerance changes the result, as float rounding may then differ
+static int reference(const Shape& _a, const Shape& _b) {
+    bool grown = isect2d::intersect(_a.scaled(1 + 1e-3f), _b.scaled(1 + 1e-3f));
+    bool shrunk = isect2d::intersect(_a.scaled(1 - 1e-3f), _b.scaled(1 - 1e-3f));
+    return grown == shrunk ? int(grown) : -1;
+}
+
+static bool close(float _a, float _b) {
+    return std::abs(_a - _b) <= 1e-3f * std::max(1.f, std::abs(_b));
+}
+
+static bool close(Vec2 _a, Vec2 _b) {
+    return close(_a.x, _b.x) && close(_a.y, _b.y);
+}
+
+static void checkBatch(const std::vector<AABB>& _aabbs, const char* _scene, int _round) {
+    Pairs expected = brute(_aabbs);
+
+    for (int config = 0; config < 48; config++) {
+        ISect2D context;
+        context.resize({16, 16}, {800, 600});
+        context.storage = config & 1 ? ISect2D::Storage::Compact : ISect2D::Storage::Buckets;
+        context.dedup = config & 2 ? ISect2D::Dedup::OwnerCell : ISect2D::Dedup::Hash;
+        context.kernel = config & 4 ? ISect2D::Kernel::Batch : ISect2D::Kernel::Scalar;
+        context.threads = config & 8 ? 3 : 1;
+        context.gridFit = config < 16 ? ISect2D::GridFit::Manual
+                        : config < 32 ? ISect2D::GridFit::Statistics : ISect2D::GridFit::Adaptive;
+
+        // Twice, for the adaptive grid to use its correction
+        for (int pass = 0; pass < 2; pass++) {
+            context.clear();
+            context.intersect(_aabbs);
+            check(sorted(context.pairs) == expected, _scene, _round * 100 + config);
+        }
+
+        context.clear();
+        context.intersect(_aabbs, [](int32_t, int32_t) { return true; });
+        check(sorted(context.pairs) == expected, "narrow intersect", _round * 100 + config);
+    }
+
+    std::vector<isect2d::IndexPair> found;
+    isect2d::intersect(_aabbs, found);
+    check(sorted(found) == expected, "bruteforce intersect", _round);
+
+    isect2d::HashGrid<Vec2> hashGrid({64, 64});
+    hashGrid.intersect(_aabbs);
+    check(sorted(hashGrid.pairs) == expected, "hash grid", _round);
+}
+
+static void checkGrid(std::mt19937& _rng) {
+    for (int round = 0; round < 20; round++) {
+        auto aabbs = randomBoxes(_rng, 500, 0, 790, 30);
+        int split = 1 + round % 10;
+
+        std::vector<isect2d::IndexPair> found;
+        isect2d::intersect(aabbs, Vec2(split, split), Vec2(800, 800), found, true);
+        check(sorted(found) == brute(aabbs), "grid intersect", round);
+    }
+}
+
+static void checkHGrid(std::mt19937& _rng) {
+    for (int round = 0; round < 20; round++) {
+        // Sizes across several levels, and boxes past the resolution
+        auto aabbs = randomBoxes(_rng, 500, -50, 850, round % 2 ? 300 : 30);
+        float cellSize = float(1 << (round % 7));
+
+        isect2d::HGrid<Vec2> grid(Vec2(800, 600), cellSize);
+        grid.intersect(aabbs);
+        check(sorted(grid.pairs) == brute(aabbs), "hgrid", round);
+
+        isect2d::HGrid<Vec2> single;
+        single.intersect(aabbs);
+        check(sorted(single.pairs) == brute(aabbs), "hgrid default", round);
+    }
+}
+
+static void checkOBBSoA(std::mt19937& _rng) {
+    for (int round = 0; round < 10; round++) {
+        auto shapes = randomShapes(_rng, 150 + round, 0, 400, 60);
+
+        std::vector<OBB> obbs;
+        Pairs pairs;
+        for (size_t i = 0; i < shapes.size(); i++) {
+            obbs.push_back(shapes[i].scaled(1));
+            for (size_t j = i + 1; j < shapes.size(); j++) {
+                pairs.emplace_back(i, j);
+            }
+        }
+
+        isect2d::OBBSoA soa;
+        soa.assign(obbs);
+
+        std::vector<uint8_t> hits;
+        isect2d::intersect(soa, pairs, hits);
+
+        // Stale bits past the last pair must be cleared
+        std::vector<uint64_t> mask((pairs.size() + 63) / 64, ~uint64_t(0));
+        isect2d::intersect(soa, pairs, mask);
+
+        bool sameHits = hits.size() == pairs.size();
+        bool sameMask = mask.size() == (pairs.size() + 63) / 64;
+        for (size_t i = 0; i < pairs.size() && sameHits && sameMask; i++) {
+            int expected = reference(shapes[pairs[i].first], shapes[pairs[i].second]);
+            bool bit = (mask[i / 64] >> (i % 64)) & 1;
+
+            sameHits = expected < 0 || hits[i] == expected;
+            sameMask = expected < 0 || bit == bool(expected);
+        }
+        for (size_t i = pairs.size(); i < mask.size() * 64 && sameMask; i++) {
+            sameMask = !((mask[i / 64] >> (i % 64)) & 1);
+        }
+        check(sameHits, "OBBSoA hits", round);
+        check(sameMask, "OBBSoA mask", round);
+    }
+}
+
+static void checkCompactOBB(std::mt19937& _rng) {
+    std::uniform_real_distribution<float> unit(0, 1);
+
+    for (int round = 0; round < 10; round++) {
+        auto shapes = randomShapes(_rng, 150, 0, 400, 60);
+
+        std::vector<CompactOBB> compacts;
+        bool sameShape = true;
+        for (auto& shape : shapes) {
+            OBB obb = shape.scaled(1);
+            compacts.push_back(CompactOBB(obb));
+
+            // Both constructors, from an axis and from an angle
+            float a = unit(_rng) * 6.3f;
+            OBB rotated(shape.center.x, shape.center.y, a, shape.w, shape.h);
+            CompactOBB compactRotated(shape.center.x, shape.center.y, a, shape.w, shape.h);
+
+            for (auto& pair : { std::make_pair(obb, compacts.back()),
+                                std::make_pair(rotated, compactRotated) }) {
+                AABB expected = pair.first.getExtent();
+                AABB extent = pair.second.getExtent();
+                auto quad = pair.second.getQuad();
+
+                sameShape = sameShape && close(extent.min, expected.min) && close(extent.max, expected.max);
+                for (int i = 0; i < 4; i++) {
+                    sameShape = sameShape && close(quad[i], pair.first.getQuad()[i]);
+                }
+            }
+        }
+        check(sameShape, "CompactOBB extent and quad", round);
+
+        bool sameHits = true;
+        for (size_t i = 0; i < shapes.size() && sameHits; i++) {
+            for (size_t j = i + 1; j < shapes.size() && sameHits; j++) {
+                int expected = reference(shapes[i], shapes[j]);
+                sameHits = expected < 0 || isect2d::intersect(compacts[i], compacts[j]) == bool(expected);
+            }
+        }
+        check(sameHits, "CompactOBB intersect", round);
+    }
+}
+
+static void checkFilter(std::mt19937& _rng) {
+    for (int round = 0; round < 4; round++) {
+        // On the grid, then partly outside of it
+        auto shapes = randomShapes(_rng, 1500, round < 2 ? 0 : -500, round < 2 ? 780 : 1300, 40);
+
+        std::vector<OBB> obbs;
+        std::vector<AABB> aabbs;
+        for (auto& shape : shapes) {
+            obbs.push_back(shape.scaled(1));
+            aabbs.push_back(obbs.back().getExtent());
+        }
+
+        auto filter = [](int32_t _a, int32_t _b) { return (_a + _b) % 3 != 0; };
+        Pairs candidates = brute(aabbs);
+        Pairs kept, expected;
+        for (auto& pair : candidates) {
+            if (!filter(pair.first, pair.second)) { continue; }
+
+            kept.push_back(pair);
+            if (isect2d::intersect(obbs[pair.first], obbs[pair.second])) {
+                expected.push_back(pair);
+            }
+        }
+
+        for (int config = 0; config < 24; config++) {
+            ISect2D context;
+            context.resize({16, 16}, {800, 600});
+            context.storage = config & 1 ? ISect2D::Storage::Compact : ISect2D::Storage::Buckets;
+            context.dedup = config & 2 ? ISect2D::Dedup::OwnerCell : ISect2D::Dedup::Hash;
+            context.kernel = config & 4 ? ISect2D::Kernel::Batch : ISect2D::Kernel::Scalar;
+            context.gridFit = config < 8 ? ISect2D::GridFit::Manual
+                            : config < 16 ? ISect2D::GridFit::Statistics : ISect2D::GridFit::Adaptive;
+
+            // Both callbacks run once per candidate pair, the narrow one
+            // only on the pairs the filter keeps
+            Pairs filtered, narrowed;
+            auto counted = [&](int32_t _a, int32_t _b) {
+                filtered.emplace_back(_a, _b);
+                return filter(_a, _b);
+            };
+            auto narrow = [&](int32_t _a, int32_t _b) {
+                narrowed.emplace_back(_a, _b);
+                return isect2d::intersect(obbs[_a], obbs[_b]);
+            };
+
+            context.intersect(aabbs, narrow, counted);
+            int id = round * 100 + config;
+            check(sorted(context.pairs) == expected, "filter pairs", id);
+            check(sorted(filtered) == candidates, "filter calls", id);
+            check(sorted(narrowed) == kept, "filter narrow calls", id);
+        }
+    }
+}
+
+// Checks _placement against greedy placement by brute force, _collide(a, b)
+// telling whether items a and b block each other
+template<typename Collide>
+static bool samePlacement(const isect2d::Placement<Vec2>& _placement, const std::vector<float>& _priorities,
+                          Collide&& _collide) {
+    size_t n = _placement.blockers.size();
+    std::vector<int32_t> order(n);
+    for (size_t i = 0; i < n; i++) { order[i] = i; }
+
+    if (!_priorities.empty()) {
+        std::stable_sort(order.begin(), order.end(), [&](int32_t _a, int32_t _b) {
+            return _priorities[_a] > _priorities[_b];
+        });
+    }
+
+    std::vector<int32_t> accepted;
+    for (int32_t item : order) {
+        // The blocker may be any accepted item colliding with this one
+        std::vector<int32_t> blocking;
+        for (int32_t other : accepted) {
+            if (_collide(item, other)) { blocking.push_back(other); }
+        }
+
+        int32_t blocker = _placement.blockers[item];
+        if (blocking.empty()) {
+            if (blocker != _placement.none) { return false; }
+            accepted.push_back(item);
+        } else if (std::find(blocking.begin(), blocking.end(), blocker) == blocking.end()) {
+            return false;
+        }
+    }
+    return _placement.accepted == accepted;
+}
+
+static void checkPlacement(std::mt19937& _rng) {
+    isect2d::Placement<Vec2> placement;
+    placement.resize({16, 16}, {800, 600});
+
+    // The same placement for every round, as its grid is kept between calls
+    for (int round = 0; round < 20; round++) {
+        auto shapes = randomShapes(_rng, 300 + round * 20, -50, 850, 40);
+
+        std::vector<OBB> obbs;
+        std::vector<CompactOBB> compacts;
+        std::vector<AABB> aabbs;
+        std::vector<float> priorities;
+        for (auto& shape : shapes) {
+            obbs.push_back(shape.scaled(1));
+            compacts.push_back(CompactOBB(obbs.back()));
+            aabbs.push_back(obbs.back().getExtent());
+            // Few priorities, for ties to keep their order
+            priorities.push_back(float(_rng() % 8));
+        }
+        if (round % 4 == 3) { priorities.clear(); }
+
+        placement.place(aabbs, priorities);
+        check(samePlacement(placement, priorities, [&](int32_t _a, int32_t _b) {
+            return aabbs[_a].intersect(aabbs[_b]);
+        }), "placement", round);
+
+        placement.place(aabbs, priorities, obbs);
+        check(samePlacement(placement, priorities, [&](int32_t _a, int32_t _b) {
+            return aabbs[_a].intersect(aabbs[_b]) && isect2d::intersect(obbs[_a], obbs[_b]);
+        }), "placement OBB", round);
+
+        placement.place(aabbs, priorities, compacts);
+        check(samePlacement(placement, priorities, [&](int32_t _a, int32_t _b) {
+            return aabbs[_a].intersect(aabbs[_b]) && isect2d::intersect(compacts[_a], compacts[_b]);
+        }), "placement CompactOBB", round);
+    }
+}
+
+/*
+ * Integer boxes from _origin, half of them at 0 or 1 unit from the previous
+ * one, which float coordinates past 2^24 can no longer tell apart
+ */
+template<typename V>
+static std::vector<isect2d::AABB<V>> integerBoxes(std::mt19937& _rng, int _n, int32_t _origin,
+                                                  int32_t _span, int32_t _size) {
+    using T = typename V::value_type;
+    std::vector<isect2d::AABB<V>> aabbs;
+
+    for (int i = 0; i < _n; i++) {
+        int32_t x = _origin + int32_t(_rng() % _span);
+        int32_t y = _origin + int32_t(_rng() % _span);
+
+        if (i % 2 == 1) {
+            x = aabbs.back().max.x + int32_t(_rng() % 2);
+            y = aabbs.back().min.y;
+        }
+        int32_t w = _rng() % (_size + 1);
+        int32_t h = _rng() % (_size + 1);
+        aabbs.push_back(isect2d::AABB<V>(T(x), T(y), T(x + w), T(y + h)));
+    }
+    return aabbs;
+}
+
+template<typename V>
+static void checkInteger(const std::vector<isect2d::AABB<V>>& _aabbs, V _resolution, V _origin,
+                         const char* _scene) {
+    using Context = isect2d::ISect2D<V>;
+    Pairs expected = brute(_aabbs);
+
+    for (int config = 0; config < 24; config++) {
+        Context context;
+        context.resize(V(16, 16), _resolution, _origin);
+        context.storage = config & 1 ? Context::Storage::Compact : Context::Storage::Buckets;
+        context.dedup = config & 2 ? Context::Dedup::OwnerCell : Context::Dedup::Hash;
+        context.kernel = config & 4 ? Context::Kernel::Batch : Context::Kernel::Scalar;
+        context.gridFit = config < 8 ? Context::GridFit::Manual
+                        : config < 16 ? Context::GridFit::Statistics : Context::GridFit::Adaptive;
+
+        for (int pass = 0; pass < 2; pass++) {
+            context.clear();
+            context.intersect(_aabbs);
+            check(sorted(context.pairs) == expected, _scene, config);
+        }
+    }
+
+    std::vector<isect2d::IndexPair> found;
+    isect2d::intersect(_aabbs, found);
+    check(sorted(found) == expected, _scene, 100);
+}
+
+static void checkIntegers(std::mt19937& _rng) {
+    using isect2d::Vec2i;
+    using isect2d::Vec2s;
+
+    for (int round = 0; round < 3; round++) {
+        // Power of two cells, found with shifts, then 50x40 cells
+        checkInteger(integerBoxes<Vec2s>(_rng, 2000, 0, 1000, 30), Vec2s(1024, 1024), Vec2s(0, 0), "Vec2s");
+        checkInteger(integerBoxes<Vec2s>(_rng, 2000, -2000, 4000, 100), Vec2s(800, 640), Vec2s(0, 0),
+                     "Vec2s world");
+        checkInteger(integerBoxes<Vec2i>(_rng, 2000, 0, 1000, 30), Vec2i(1024, 1024), Vec2i(0, 0), "Vec2i");
+
+        // Past 2^24, where floats round the box edges
+        int32_t far = (1 << 25) + 1;
+        checkInteger(integerBoxes<Vec2i>(_rng, 2000, far, 1000, 30), Vec2i(1024, 1024), Vec2i(far, far),
+                     "Vec2i far");
+        checkInteger(integerBoxes<Vec2i>(_rng, 2000, far, 1000, 30), Vec2i(800, 640), Vec2i(0, 0),
+                     "Vec2i far outside");
+    }
+}
+
+// User record holding its box among other members
+struct Record {
+    int32_t id;
+    AABB box;
+    OBB obb;
+};
+
+static void checkBoxView(std::mt19937& _rng) {
+    for (int round = 0; round < 4; round++) {
+        auto shapes = randomShapes(_rng, 1500, round < 2 ? 0 : -500, round < 2 ? 780 : 1300, 40);
+
+        std::vector<Record> records;
+        std::vector<OBB> obbs;
+        std::vector<AABB> aabbs;
+        for (auto& shape : shapes) {
+            obbs.push_back(shape.scaled(1));
+            aabbs.push_back(obbs.back().getExtent());
+            records.push_back({ int32_t(records.size()), aabbs.back(), obbs.back() });
+        }
+
+        // Boxes read by reference, by value, and through a pointer and stride
+        auto byRecord = isect2d::boxView(records, [](const Record& _r) -> const AABB& { return _r.box; });
+        auto byExtent = isect2d::boxView(records, [](const Record& _r) { return _r.obb.getExtent(); });
+        auto byStride = isect2d::boxView(&records[0].box, records.size(),
+                                         [](const AABB& _box) -> const AABB& { return _box; }, sizeof(Record));
+
+        auto narrow = [&](int32_t _a, int32_t _b) { return isect2d::intersect(obbs[_a], obbs[_b]); };
+
+        for (int config = 0; config < 24; config++) {
+            ISect2D context;
+            context.resize({16, 16}, {800, 600});
+            context.storage = config & 1 ? ISect2D::Storage::Compact : ISect2D::Storage::Buckets;
+            context.dedup = config & 2 ? ISect2D::Dedup::OwnerCell : ISect2D::Dedup::Hash;
+            context.kernel = config & 4 ? ISect2D::Kernel::Batch : ISect2D::Kernel::Scalar;
+            context.gridFit = config < 8 ? ISect2D::GridFit::Manual
+                            : config < 16 ? ISect2D::GridFit::Statistics : ISect2D::GridFit::Adaptive;
+            int id = round * 100 + config;
+
+            context.intersect(aabbs);
+            Pairs plain = sorted(context.pairs);
+            context.intersect(aabbs, narrow);
+            Pairs narrowed = sorted(context.pairs);
+
+            context.intersect(byRecord);
+            check(sorted(context.pairs) == plain, "box view", id);
+            context.intersect(byExtent);
+            check(sorted(context.pairs) == plain, "box view by value", id);
+            context.intersect(byStride);
+            check(sorted(context.pairs) == plain, "box view stride", id);
+
+            context.intersect(byRecord, narrow);
+            check(sorted(context.pairs) == narrowed, "box view narrow", id);
+            context.intersect(byStride, narrow);
+            check(sorted(context.pairs) == narrowed, "box view stride narrow", id);
+        }
+
+        isect2d::HashGrid<Vec2> hashGrid({64, 64});
+        hashGrid.intersect(byStride);
+        check(sorted(hashGrid.pairs) == brute(aabbs), "hash grid box view", round);
+    }
+}
+
+static void checkHandles(std::mt19937& _rng) {
+    ISect2D context;
+    context.resize({16, 16}, {800, 600});
+
+    std::vector<AABB> aabbs;
+    std::vector<bool> alive;
+    Pairs previous;
+
+    for (int round = 0; round < 100; round++) {
+        int ops = 1 + _rng() % 50;
+
+        for (int op = 0; op < ops; op++) {
+            int32_t handle = aabbs.empty() ? 0 : _rng() % aabbs.size();
+            int kind = _rng() % 4;
+
+            if (kind == 0 || aabbs.empty() || !alive[handle]) {
+                AABB aabb = randomBox(_rng, -50, 800, 40);
+                int32_t added = context.add(aabb);
+                if (added >= int32_t(aabbs.size())) {
+                    aabbs.resize(added + 1);
+                    alive.resize(added + 1);
+                }
+                aabbs[added] = aabb;
+                alive[added] = true;
+            } else if (kind == 1) {
+                context.remove(handle);
+                alive[handle] = false;
+            } else {
+                AABB& aabb = aabbs[handle];
+                float dx = float(int(_rng() % 21) - 10);
+                float dy = float(int(_rng() % 21) - 10);
+                aabb = AABB(aabb.min.x + dx, aabb.min.y + dy, aabb.max.x + dx, aabb.max.y + dy);
+                context.update(handle, aabb);
+            }
+        }
+
+        context.updatePairs();
+        Pairs current = brute(aabbs, alive);
+
+        check(sorted(context.addedPairs) == difference(current, previous), "handles added", round);
+        check(sorted(context.removedPairs) == difference(previous, current), "handles removed", round);
+        check(context.persistingPairs.empty(), "handles persisting", round);
+
+        previous = current;
+    }
+}
+
+static void checkFrames(std::mt19937& _rng) {
+    ISect2D context;
+    context.resize({16, 16}, {800, 600});
+
+    std::vector<AABB> aabbs = randomBoxes(_rng, 300, 0, 780, 30);
+    Pairs previous;
+
+    for (int round = 0; round < 50; round++) {
+        // Jitter some boxes, and grow or shrink the frame
+        for (auto& aabb : aabbs) {
+            if (_rng() % 3 == 0) {
+                float dx = float(int(_rng() % 11) - 5);
+                float dy = float(int(_rng() % 11) - 5);
+                aabb = AABB(aabb.min.x + dx, aabb.min.y + dy, aabb.max.x + dx, aabb.max.y + dy);
+            }
+        }
+        if (round % 5 == 1) {
+            aabbs.resize(aabbs.size() - _rng() % 50);
+        } else if (round % 5 == 3) {
+            for (int i = _rng() % 50; i > 0; i--) {
+                aabbs.push_back(randomBox(_rng, 0, 780, 30));
+            }
+        }
+
+        context.updateFrame(aabbs);
+        Pairs current = brute(aabbs);
+
+        check(sorted(context.addedPairs) == difference(current, previous), "frame added", round);
+        check(sorted(context.persistingPairs) == common(current, previous), "frame persisting", round);
+        check(sorted(context.removedPairs) == difference(previous, current), "frame removed", round);
+
+        previous = current;
+    }
+}
+
+// Independent slab test of the segment [_a, _b] against _box
+static bool segmentHits(Vec2 _a, Vec2 _b, const AABB& _box) {
+    double t0 = 0, t1 = 1;
+    double p[2] = { _a.x, _a.y };
+    double d[2] = { double(_b.x) - _a.x, double(_b.y) - _a.y };
+    double lo[2] = { _box.min.x, _box.min.y };
+    double hi[2] = { _box.max.x, _box.max.y };
+
+    for (int axis = 0; axis < 2; axis++) {
+        if (d[axis] == 0) {
+            if (p[axis] < lo[axis] || p[axis] > hi[axis]) { return false; }
+            continue;
+        }
+        double u = (lo[axis] - p[axis]) / d[axis];
+        double w = (hi[axis] - p[axis]) / d[axis];
+        t0 = std::max(t0, std::min(u, w));
+        t1 = std::min(t1, std::max(u, w));
+    }
+    return t0 <= t1;
+}
+
+static float boxDistance(Vec2 _p, const AABB& _box) {
+    float x = std::max({ _box.min.x - _p.x, _p.x - _box.max.x, 0.f });
+    float y = std::max({ _box.min.y - _p.y, _p.y - _box.max.y, 0.f });
+    return std::sqrt(x * x + y * y);
+}
+
+// Checks the distances of _result against the _k least of _distances
+static bool sameNearest(const std::vector<ISect2D::Neighbor>& _result,
+                        std::vector<float> _distances, size_t _k) {
+    std::sort(_distances.begin(), _distances.end());
+    _distances.resize(std::min(_k, _distances.size()));
+
+    if (_result.size() != _distances.size()) { return false; }
+
+    for (size_t i = 0; i < _result.size(); i++) {
+        if (!close(_result[i].distance, _distances[i])) { return false; }
+    }
+    return true;
+}
+
+// Checks that _result holds each box within _radius once, ignoring those
+// on the boundary
+static bool sameWithin(const std::vector<ISect2D::Neighbor>& _result,
+                       const std::vector<float>& _distances, float _radius) {
+    std::vector<int> seen(_distances.size(), 0);
+
+    for (auto& n : _result) {
+        if (seen[n.index]++ || !close(n.distance, _distances[n.index]) ||
+            (_distances[n.index] > _radius && !close(_distances[n.index], _radius))) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < _distances.size(); i++) {
+        if (!seen[i] && _distances[i] < _radius && !close(_distances[i], _radius)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void checkQueries(std::mt19937& _rng) {
+    std::uniform_real_distribution<float> coord(-100, 900);
+    std::uniform_real_distribution<float> unit(0, 1);
+
+    for (int round = 0; round < 10; round++) {
+        ISect2D context;
+        context.resize(Vec2(1 + round, 1 + round * 2), {800, 600});
+
+        std::vector<OBB> obbs;
+        std::vector<AABB> aabbs;
+
+        for (int i = 0; i < 400; i++) {
+            Vec2 center(coord(_rng), coord(_rng));
+            float w = 1 + unit(_rng) * 40;
+            float h = 1 + unit(_rng) * 40;
+
+            if (i % 4 == 0) {
+                // Axis of any length, as allowed by OBB
+                float a = unit(_rng) * 6.3f;
+                float scale = 0.5f + unit(_rng) * 3;
+                obbs.push_back(OBB(center, Vec2(std::cos(a) * scale, std::sin(a) * scale), w, h));
+            } else {
+                obbs.push_back(OBB(center.x, center.y, unit(_rng) * 6.3f, w, h));
+            }
+            aabbs.push_back(obbs.back().getExtent());
+            context.add(aabbs.back());
+        }
+
+        for (int q = 0; q < 50; q++) {
+            int id = round * 100 + q;
+            std::vector<int32_t> hits;
+            auto collect = [&](int32_t _i) { hits.push_back(_i); return true; };
+
+            AABB rect = randomBox(_rng, -100, 900, 200);
+            std::vector<int32_t> expected;
+            for (size_t i = 0; i < aabbs.size(); i++) {
+                if (rect.intersect(aabbs[i])) { expected.push_back(i); }
+            }
+            context.queryRect(rect, collect);
+            std::sort(hits.begin(), hits.end());
+            check(hits == expected, "queryRect", id);
+
+            Vec2 a(coord(_rng), coord(_rng));
+            Vec2 b = q % 5 == 0 ? Vec2(a.x, coord(_rng)) : Vec2(coord(_rng) * 4, coord(_rng) * 4);
+            hits.clear();
+            expected.clear();
+            for (size_t i = 0; i < aabbs.size(); i++) {
+                if (segmentHits(a, b, aabbs[i])) { expected.push_back(i); }
+            }
+            context.querySegment(a, b, collect);
+            std::sort(hits.begin(), hits.end());
+            check(hits == expected, "querySegment", id);
+
+            Vec2 p(coord(_rng), coord(_rng));
+            std::vector<float> boxDistances, obbDistances;
+            for (size_t i = 0; i < aabbs.size(); i++) {
+                boxDistances.push_back(boxDistance(p, aabbs[i]));
+                obbDistances.push_back(isect2d::distance(obbs[i], p));
+            }
+
+            std::vector<ISect2D::Neighbor> result;
+            size_t k = 1 + q % 12;
+
+            context.nearest(p, k, result);
+            check(sameNearest(result, boxDistances, k), "nearest", id);
+
+            context.nearest(p, k, obbs, result);
+            check(sameNearest(result, obbDistances, k), "nearest OBB", id);
+
+            float radius = unit(_rng) * 100;
+
+            context.within(p, radius, result);
+            check(sameWithin(result, boxDistances, radius), "within", id);
+
+            context.within(p, radius, obbs, result);
+            check(sameWithin(result, obbDistances, radius), "within OBB", id);
+        }
+    }
+}
+
+// _p in the frame of _shape, whose box spans [-w/2, w/2] x [-h/2, h/2] there
+static Vec2 local(const Shape& _shape, Vec2 _p) {
+    Vec2 n = _shape.normal;
+    float dx = _p.x - _shape.center.x;
+    float dy = _p.y - _shape.center.y;
+    float squared = n.x * n.x + n.y * n.y;
+    return Vec2((dx * n.x + dy * n.y) / squared, (dy * n.x - dx * n.y) / squared);
+}
+
+// Whether [_a, _b] hits _shape scaled by 1 + 1e-3 and by 1 - 1e-3, -1
+// when only the grown shape is hit
+static int segmentReference(const Shape& _shape, Vec2 _a, Vec2 _b) {
+    Vec2 a = local(_shape, _a);
+    Vec2 b = local(_shape, _b);
+    auto hits = [&](float _scale) {
+        float x = _shape.w * _scale / 2;
+        float y = _shape.h * _scale / 2;
+        return segmentHits(a, b, AABB(-x, -y, x, y));
+    };
+    bool grown = hits(1 + 1e-3f);
+    bool shrunk = hits(1 - 1e-3f);
+    return grown == shrunk ? int(grown) : -1;
+}
+
+// Whether the hits of a refined query match _reference(i) for each box i,
+// ignoring the boxes where it is -1
+template<typename Reference>
+static bool sameRefined(std::vector<int32_t> _hits, size_t _count, Reference&& _reference) {
+    std::sort(_hits.begin(), _hits.end());
+    if (std::adjacent_find(_hits.begin(), _hits.end()) != _hits.end()) { return false; }
+
+    for (size_t i = 0; i < _count; i++) {
+        int expected = _reference(i);
+        bool hit = std::binary_search(_hits.begin(), _hits.end(), int32_t(i));
+        if (expected >= 0 && hit != bool(expected)) { return false; }
+    }
+    return true;
+}
+
+static void checkRefinedQueries(std::mt19937& _rng) {
+    std::uniform_real_distribution<float> coord(-100, 900);
+
+    for (int round = 0; round < 10; round++) {
+        ISect2D context;
+        context.resize(Vec2(1 + round, 1 + round * 2), {800, 600});
+
+        auto shapes = randomShapes(_rng, 400, -100, 900, 40);
+        std::vector<OBB> obbs;
+        std::vector<CompactOBB> compacts;
+        std::vector<AABB> aabbs;
+        for (auto& shape : shapes) {
+            obbs.push_back(shape.scaled(1));
+            compacts.push_back(CompactOBB(obbs.back()));
+            aabbs.push_back(obbs.back().getExtent());
+            context.add(aabbs.back());
+        }
+
+        for (int q = 0; q < 50; q++) {
+            int id = round * 100 + q;
+            std::vector<int32_t> hits, compactHits;
+            auto collect = [&](int32_t _i) { hits.push_back(_i); return true; };
+            auto collectCompact = [&](int32_t _i) { compactHits.push_back(_i); return true; };
+
+            // A point inside of some box now and then
+            Vec2 p = q % 3 == 0 ? shapes[_rng() % shapes.size()].center : Vec2(coord(_rng), coord(_rng));
+            context.queryPoint(p, collect);
+            check(sameRefined(hits, aabbs.size(), [&](size_t _i) {
+                return int(aabbs[_i].intersect(AABB(p.x, p.y, p.x, p.y)));
+            }), "queryPoint", id);
+
+            hits.clear();
+            context.queryPoint(p, obbs, collect);
+            context.queryPoint(p, compacts, collectCompact);
+            auto inside = [&](size_t _i) { return segmentReference(shapes[_i], p, p); };
+            check(sameRefined(hits, aabbs.size(), inside), "queryPoint OBB", id);
+            check(sameRefined(compactHits, aabbs.size(), inside), "queryPoint CompactOBB", id);
+
+            AABB rect = randomBox(_rng, -100, 900, 200);
+            Shape probe = { (rect.min + rect.max) * 0.5, Vec2(1, 0),
+                            rect.max.x - rect.min.x, rect.max.y - rect.min.y };
+            hits.clear();
+            compactHits.clear();
+            context.queryRect(rect, obbs, collect);
+            context.queryRect(rect, compacts, collectCompact);
+            auto overlaps = [&](size_t _i) { return reference(probe, shapes[_i]); };
+            check(sameRefined(hits, aabbs.size(), overlaps), "queryRect OBB", id);
+            check(sameRefined(compactHits, aabbs.size(), overlaps), "queryRect CompactOBB", id);
+
+            Vec2 a(coord(_rng), coord(_rng));
+            Vec2 b = q % 7 == 0 ? a : Vec2(coord(_rng), coord(_rng));
+            hits.clear();
+            compactHits.clear();
+            context.querySegment(a, b, obbs, collect);
+            context.querySegment(a, b, compacts, collectCompact);
+            auto crossed = [&](size_t _i) { return segmentReference(shapes[_i], a, b); };
+            check(sameRefined(hits, aabbs.size(), crossed), "querySegment OBB", id);
+            check(sameRefined(compactHits, aabbs.size(), crossed), "querySegment CompactOBB", id);
+        }
+    }
+}
+
+static void checkSAP(std::mt19937& _rng) {
+    isect2d::SAP<Vec2> sap;
+    auto aabbs = randomBoxes(_rng, 1000, 0, 780, 30);
+
+    for (int round = 0; round < 30; round++) {
+        // Small moves for the incremental re-sort, then a reshuffle
+        for (auto& aabb : aabbs) {
+            float dx = round % 10 == 9 ? float(int(_rng() % 401) - 200) : float(int(_rng() % 5) - 2);
+            aabb = AABB(aabb.min.x + dx, aabb.min.y, aabb.max.x + dx, aabb.max.y);
+        }
+        sap.intersect(aabbs);
+        check(sorted(sap.pairs) == brute(aabbs), "SAP", round);
+    }
+}
+
+static void checkTree(std::mt19937& _rng) {
+    isect2d::AABBTree<Vec2> tree;
+    std::vector<AABB> aabbs;
+    std::vector<bool> alive;
+
+    for (int round = 0; round < 100; round++) {
+        for (int op = 0; op < 20; op++) {
+            int kind = _rng() % 4;
+            int32_t id = aabbs.empty() ? 0 : _rng() % aabbs.size();
+
+            if (kind == 0 || aabbs.empty() || !alive[id]) {
+                AABB aabb = randomBox(_rng, 0, 780, 30);
+                int32_t added = tree.insert(aabb);
+                if (added >= int32_t(aabbs.size())) {
+                    aabbs.resize(added + 1);
+                    alive.resize(added + 1);
+                }
+                aabbs[added] = aabb;
+                alive[added] = true;
+            } else if (kind == 1) {
+                tree.remove(id);
+                alive[id] = false;
+            } else {
+                AABB& aabb = aabbs[id];
+                float dx = float(int(_rng() % 21) - 10);
+                float dy = float(int(_rng() % 21) - 10);
+                aabb = AABB(aabb.min.x + dx, aabb.min.y + dy, aabb.max.x + dx, aabb.max.y + dy);
+                tree.update(id, aabb);
+            }
+        }
+
+        tree.intersect();
+        check(sorted(tree.pairs) == brute(aabbs, alive), "AABBTree", round);
+    }
+}
+
+// Runs _frames through the plain and narrow paths of _context, and the
+// frame to frame path of _coherent, as handles are not to be mixed with
+// the other calls
+template<typename Context>
+static void runFrames(Context& _context, Context& _coherent, const std::vector<std::vector<AABB>>& _frames) {
+    for (auto& aabbs : _frames) {
+        _context.clear();
+        _context.intersect(aabbs, [](int32_t _a, int32_t _b) { return (_a + _b) % 2 == 0; });
+        _context.clear();
+        _context.intersect(aabbs);
+        _coherent.updateFrame(aabbs);
+    }
+}
+
+static void checkAllocations(std::mt19937& _rng) {
+    using Context = isect2d::ISect2D<Vec2, isect2d::CheckedAllocator>;
+
+    // Jittered copies of one scene, partly outside of the grid
+    std::vector<std::vector<AABB>> frames(1, randomBoxes(_rng, 2000, -100, 900, 30));
+    for (int i = 1; i < 6; i++) {
+        frames.push_back(frames.back());
+        for (auto& aabb : frames.back()) {
+            float dx = float(int(_rng() % 11) - 5);
+            float dy = float(int(_rng() % 11) - 5);
+            aabb = AABB(aabb.min.x + dx, aabb.min.y + dy, aabb.max.x + dx, aabb.max.y + dy);
+        }
+    }
+
+    for (int config = 0; config < 24; config++) {
+        Context context, coherent;
+        context.resize({16, 16}, {800, 600});
+        context.storage = config & 1 ? Context::Storage::Compact : Context::Storage::Buckets;
+        context.dedup = config & 2 ? Context::Dedup::OwnerCell : Context::Dedup::Hash;
+        context.kernel = config & 4 ? Context::Kernel::Batch : Context::Kernel::Scalar;
+        context.gridFit = config < 8 ? Context::GridFit::Manual
+                        : config < 16 ? Context::GridFit::Statistics : Context::GridFit::Adaptive;
+        context.reserve(2000, 20000);
+        coherent.resize({16, 16}, {800, 600});
+        coherent.reserve(2000, 20000);
+
+        // Warm-up, for the buckets, gathered bounds and contacts to reach
+        // their largest size, including from the last frame to the first
+        for (int pass = 0; pass < 2; pass++) {
+            runFrames(context, coherent, frames);
+        }
+
+        size_t before = isect2d::AllocationCounter::get().allocations;
+        runFrames(context, coherent, frames);
+        bool none = isect2d::AllocationCounter::get().allocations == before;
+        check(none, "allocations after warm-up", config);
+
+        if (none) {
+            // CheckedAllocator asserts on any allocation in the scope
+            isect2d::NoAllocationScope scope;
+            runFrames(context, coherent, frames);
+        }
+        Pairs expected = brute(frames.back());
+        check(sorted(context.pairs) == expected, "allocations pairs", config);
+
+        Pairs current = sorted(coherent.addedPairs);
+        current.insert(current.end(), coherent.persistingPairs.begin(), coherent.persistingPairs.end());
+        std::sort(current.begin(), current.end());
+        check(current == expected, "allocations frame pairs", config);
+    }
+}
+
+int main() {
+    std::mt19937 rng(1);
+
+    for (int round = 0; round < 3; round++) {
+        checkBatch(randomBoxes(rng, 2000, 0, 780, 30), "batch screen", round);
+        // Far outside of the 800x600 grid, and spread for the fitted grids
+        checkBatch(randomBoxes(rng, 2000, -3000, 3000, 200), "batch world", round);
+    }
+
+    // Few boxes, whose fitted bounds must not cross
+    checkBatch({ AABB(0, 0, 1, 1), AABB(100, 0, 101, 1) }, "batch two boxes", 0);
+    checkBatch({ AABB(0, 0, 1, 1), AABB(100, 100, 101, 101) }, "batch two boxes", 1);
+
+    // Strided sample of the fitted bounds holding only empty boxes
+    std::vector<AABB> sparse(8192);
+    for (size_t i = 1; i < sparse.size(); i += 2) {
+        sparse[i] = randomBox(rng, 0, 780, 10);
+    }
+    checkBatch(sparse, "batch sparse", 0);
+
+    checkGrid(rng);
+    checkHGrid(rng);
+    checkOBBSoA(rng);
+    checkCompactOBB(rng);
+    checkFilter(rng);
+    checkPlacement(rng);
+    checkIntegers(rng);
+    checkBoxView(rng);
+    checkHandles(rng);
+    checkFrames(rng);
+    checkQueries(rng);
+    checkRefinedQueries(rng);
+    checkSAP(rng);
+    checkTree(rng);
+    checkAllocations(rng);
+
+    if (failures > 0) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "isect2d.h"
 #include "vec2.h"
+#include "scenes.h"
 
 #include <iostream>
 #include <cmath>
@@ -75,50 +76,11 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 void initBBoxes() {
 
 #if defined CIRCLES
-    int n = N_BOX;
-    float o = (2 * M_PI) / n;
-    float size = 200;
-    float boxSize = n / (0.4 * n);
-
-    for (int i = 0; i < n; ++i) {
-        float r = rand_0_1(20);
-
-        obbs.push_back(OBB(cos(o * i) * size + width / 2,
-                    sin(o * i) * size + height / 2, r,
-                    r + boxSize * 8, r * boxSize / 3 + boxSize));
-    }
+    obbs = scenes::circles<Vec2>(N_BOX, width, height);
 #elif defined AREA
-    int n = N_BOX;
-    float boxWidth = 10;
-    float boxHeight = 5;
-
-    std::default_random_engine generator;
-    std::uniform_real_distribution<double> xDistribution(-350.0,350.0);
-    std::uniform_real_distribution<double> yDistribution(-250.0,250.0);
-    std::uniform_real_distribution<double> boxScaleDist(-2.0f,2.0f);
-    for(int i = 0; i < n; i++) {
-        float boxSizeFactorW = boxScaleDist(generator);
-        float boxSizeFactorH = boxScaleDist(generator);
-        float xVal = xDistribution(generator) + width/2.0f;
-        float yVal = yDistribution(generator) + height/2.0f;
-        float angle = yVal/(xVal+1.0f);
-        obbs.push_back(OBB(xVal, yVal, angle+M_PI*i/4,
-                           boxWidth-boxSizeFactorW,
-                           boxHeight-boxSizeFactorH));
-    }
+    obbs = scenes::area<Vec2>(N_BOX, width, height);
 #else
-    int n = 10;
-    float o = (2 * M_PI) / n;
-    float size = 50;
-    float boxSize = 15;
-
-    for (int i = 0; i < n; ++i) {
-        float r = rand_0_1(20);
-
-        obbs.push_back(OBB(cos(o * i) * size + width / 2,
-                    sin(o * i) * size + height / 2, r,
-                    r + boxSize * 8, r * boxSize / 3 + boxSize));
-    }
+    obbs = scenes::ring<Vec2>(10, width, height);
 #endif
 
 }
@@ -192,6 +154,9 @@ void render() {
     isect2d::ISect2D<Vec2> context;
     context.resize({n2, n2}, {800, 600});
 
+    // Rather than n2, let the grid follow the boxes as they move
+    context.gridFit = isect2d::ISect2D<Vec2>::GridFit::Adaptive;
+
     while (!glfwWindowShouldClose(window)) {
         update();
 
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "obb.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+/*
+ * Box layouts shared by the interactive demo and the headless benchmark.
+ * Every scene fills a _width x _height screen with n oriented boxes.
+ */
+namespace scenes {
+
+inline float rand_0_1(float scale) {
+    return ((float)rand() / (float)(RAND_MAX)) * scale;
+}
+
+// Boxes laid out on a large ring, of random sizes independent of n
+template<typename V>
+std::vector<isect2d::OBB<V>> circles(int n, float width, float height) {
+    std::vector<isect2d::OBB<V>> obbs;
+    float o = (2 * M_PI) / n;
+    float size = 200;
+    float boxSize = n / (0.4 * n);
+
+    for (int i = 0; i < n; ++i) {
+        float r = rand_0_1(20);
+
+        obbs.push_back(isect2d::OBB<V>(cos(o * i) * size + width / 2,
+                    sin(o * i) * size + height / 2, r,
+                    r + boxSize * 8, r * boxSize / 3 + boxSize));
+    }
+
+    return obbs;
+}
+
+// Small boxes uniformly scattered over most of the screen
+template<typename V>
+std::vector<isect2d::OBB<V>> area(int n, float width, float height) {
+    std::vector<isect2d::OBB<V>> obbs;
+    float boxWidth = 10;
+    float boxHeight = 5;
+
+    std::default_random_engine generator;
+    std::uniform_real_distribution<double> xDistribution(-350.0,350.0);
+    std::uniform_real_distribution<double> yDistribution(-250.0,250.0);
+    std::uniform_real_distribution<double> boxScaleDist(-2.0f,2.0f);
+    for(int i = 0; i < n; i++) {
+        float boxSizeFactorW = boxScaleDist(generator);
+        float boxSizeFactorH = boxScaleDist(generator);
+        float xVal = xDistribution(generator) + width/2.0f;
+        float yVal = yDistribution(generator) + height/2.0f;
+        float angle = yVal/(xVal+1.0f);
+        obbs.push_back(isect2d::OBB<V>(xVal, yVal, angle+M_PI*i/4,
+                           boxWidth-boxSizeFactorW,
+                           boxHeight-boxSizeFactorH));
+    }
+
+    return obbs;
+}
+
+// A small ring of large boxes around the screen center
+template<typename V>
+std::vector<isect2d::OBB<V>> ring(int n, float width, float height) {
+    std::vector<isect2d::OBB<V>> obbs;
+    float o = (2 * M_PI) / n;
+    float size = 50;
+    float boxSize = 15;
+
+    for (int i = 0; i < n; ++i) {
+        float r = rand_0_1(20);
+
+        obbs.push_back(isect2d::OBB<V>(cos(o * i) * size + width / 2,
+                    sin(o * i) * size + height / 2, r,
+                    r + boxSize * 8, r * boxSize / 3 + boxSize));
+    }
+
+    return obbs;
+}
+
+}